@@ -48,6 +48,7 @@ struct post {
 	char *trip; /* optional */
 	char *subject; /* optional */
 	char *comment;
+	char *rendered; /* comment markup, NULL if stale */
 };
 
 struct resource {
@@ -55,6 +56,73 @@ struct resource {
 	struct post *arr;
 };
 
+/* posts quoting a post, ordered by post_id */
+struct backlink {
+	long post_id; /* quoted post */
+	long from_parent;
+	long from_id;
+};
+
+struct backlinks {
+	unsigned count;
+	struct backlink *arr;
+};
+
+/* thread statistics */
+
+struct thread_stats {
+	long replies;
+	long last_post; /* newest post id */
+	long posters; /* unique IPs */
+	int bump_limit; /* non-zero if no longer bumped */
+};
+
+/* prepared statement registry */
+/* statements are prepared once per connection on first use,
+ * parameters are bound in order according to their bind string
+ * 's' - const char * (NULL binds SQL NULL)
+ * 'l' - long
+ */
+enum statement {
+	/* validation */
+	SQL_BOARD_STATUS, SQL_THREAD_STATUS,
+	SQL_FIND_PARENT, SQL_ACTIVE_STATUS, SQL_ARCHIVE_STATUS,
+	SQL_BOARD_POSTS, SQL_THREAD_POSTS, SQL_THREAD_STATS,
+	/* flood control */
+	SQL_USER_THREADS, SQL_DUPLICATE_POST, SQL_DUPLICATE_TEXT, SQL_COOLDOWN,
+	/* insertion */
+	SQL_BEGIN, SQL_COMMIT, SQL_ROLLBACK,
+	SQL_NEXT_POST_ID, SQL_INSERT_THREAD, SQL_INSERT_POST,
+	SQL_INSERT_POSTER, SQL_INSERT_STATS, SQL_UPDATE_STATS,
+	SQL_FETCH_POST, SQL_DELETE_POST, SQL_DELETE_THREAD,
+	SQL_DELETE_ACTIVE, SQL_DELETE_ARCHIVED,
+	SQL_DELETE_STATS, SQL_DELETE_POSTERS,
+	SQL_DELETE_QUOTES, SQL_DELETE_QUOTING, SQL_DELETE_POST_QUOTES, SQL_DELETE_POST_QUOTING,
+	SQL_UNCOUNT_POST,
+	SQL_BUMP_THREAD,
+	SQL_ACTIVE_COUNT, SQL_ARCHIVE_STALE, SQL_DELETE_STALE,
+	SQL_DELETE_EXPIRED_POSTS, SQL_DELETE_EXPIRED_STATS,
+	SQL_DELETE_EXPIRED_POSTERS, SQL_DELETE_EXPIRED_QUOTES,
+	SQL_DELETE_EXPIRED_QUOTING, SQL_DELETE_EXPIRED,
+	/* resource fetching */
+	SQL_BOARD_LIST,
+	SQL_THREAD, SQL_INDEX_THREADS, SQL_INDEX_POSTS, SQL_CATALOG,
+	SQL_ARCHIVED_COUNT, SQL_ARCHIVE_PAGE,
+	SQL_SEARCH,
+	/* dump and restore */
+	SQL_DUMP_BOARD, SQL_DUMP_ACTIVE, SQL_DUMP_ARCHIVED, SQL_DUMP_POSTS,
+	SQL_RESTORE_BOARD, SQL_RESTORE_ACTIVE, SQL_RESTORE_ARCHIVED,
+	SQL_RESTORE_STAGE, SQL_STAGE_POST, SQL_RESTORE_POSTS, SQL_RESTORE_UNSTAGE,
+	SQL_RESTORE_POSTERS, SQL_RESTORE_STATS,
+	SQL_PURGE_POSTS, SQL_PURGE_STATS, SQL_PURGE_POSTERS, SQL_PURGE_QUOTES,
+	SQL_PURGE_ACTIVE, SQL_PURGE_ARCHIVED, SQL_PURGE_BOARD,
+	/* comment markup */
+	SQL_RESOLVE_QUOTES, SQL_STALE_MARKUP, SQL_UPDATE_MARKUP,
+	/* backlinks */
+	SQL_INSERT_QUOTE, SQL_THREAD_BACKLINKS, SQL_POST_BACKLINKS,
+	SQL_STATEMENTS /* total count */
+};
+
 /* SQLite3 error lookup */
 extern const char *const sqlite3_err[];
 
@@ -62,9 +130,20 @@ extern const char *const sqlite3_err[];
 char *sql_generate(const char *fmt, ...);
 void thread_redirect(const char *board_id, long parent_id, long post_id);
 
+/* connection */
+int db_open(sqlite3 **db, int flags);
+void db_busy_timeout(sqlite3 *db, long ms);
+void db_pause(long ms);
+void db_lock_report(const char *ident);
+void db_close(sqlite3 *db);
+
+/* statement registry */
+sqlite3_stmt *db_statement(sqlite3 *db, enum statement id, ...);
+int db_transaction(sqlite3 *db, enum statement id, ...);
+
 /* value retrieval */
-long db_retrieval(sqlite3 *db, const char *sql);
-long *db_array_retrieval(sqlite3 *db, const char *sql, unsigned n);
+long db_retrieval(sqlite3 *db, enum statement id, ...);
+long *db_array_retrieval(sqlite3 *db, unsigned n, enum statement id, ...);
 
 /* validation */
 unsigned db_status_flags(sqlite3 *db, const char *board_id, const long id);
@@ -72,6 +151,7 @@ long db_find_parent(sqlite3 *db, const char *board_id, const long id);
 int db_active_status(sqlite3 *db, const char *board_id, const long id);
 int db_archive_status(sqlite3 *db, const char *board_id, const long id);
 long db_total_posts(sqlite3 *db, const char *board_id, const long id);
+int db_thread_stats(sqlite3 *db, const char *board_id, const long id, struct thread_stats *ts);
 
 #ifdef NDEBUG /* flood control */
 long db_user_threads(sqlite3 *db, const char *board_id, const char *ip_addr);
@@ -84,15 +164,26 @@ long db_cooldown_timer(sqlite3 *db, const char *ip_addr);
 #endif
 
 /* insertion */
+int db_begin(sqlite3 *db);
+int db_commit(sqlite3 *db);
+void db_rollback(sqlite3 *db);
+long db_next_post_id(sqlite3 *db, const char *board_id);
 int db_post_insert(sqlite3 *db, struct post *cm);
 int db_post_delete(sqlite3 *db, const char *board_id, const long id);
 int db_bump_parent(sqlite3 *db, const char *board_id, const long id);
-int db_archive_oldest(sqlite3 *db, const char *board_id);
+int db_archive_oldest(sqlite3 *db, const char *board_id, long *archived);
+int db_expire_oldest(sqlite3 *db, const char *board_id, long limit, long *expired);
+int db_restore_stage(sqlite3 *db);
+int db_restore_flush(sqlite3 *db);
+int db_restore_stats(sqlite3 *db, const char *board_id);
+int db_board_purge(sqlite3 *db, const char *board_id);
 
 /* resource fetching */
 long db_board_fetch(sqlite3 *db, struct board *ls);
 void db_board_free(struct board *ls);
-long db_resource_fetch(sqlite3 *db, struct resource *res, const char *sql);
+long db_resource_fetch(sqlite3 *db, struct resource *res, unsigned hint, enum statement id, ...);
 void db_resource_free(struct resource *res);
+long db_backlink_fetch(sqlite3 *db, struct backlinks *bl, enum statement id, ...);
+void db_backlink_free(struct backlinks *bl);
 
 #endif
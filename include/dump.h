@@ -0,0 +1,23 @@
+#ifndef DUMP_H
+#define DUMP_H
+
+/* akari-dump format
+ * one record per line, fields separated by tabs, the first field
+ * is the record type, a board's records appear in this order
+ *   akari-dump version
+ *   B id name desc status post_seq
+ *   A post_id last_bump status ip
+ *   X post_id expiry replies name trip subject comment
+ *   P parent_id id time options user_priv del_pass ip name trip subject comment
+ * B is the board, A and X are active and archived threads, P are posts
+ * text escapes '\\', '\t', '\n' and '\r' C-style, NULL is written as \N
+ * thread statistics, fingerprints, comment markup, backlinks and the
+ * search index aren't dumped, akari-restore rebuilds them
+ */
+#define DUMP_VER 1
+#define DUMP_MAX_FIELDS 12
+
+size_t dump_escape(char *dest, const char *src);
+unsigned dump_split(char *line, char **field, unsigned n);
+
+#endif
@@ -27,14 +27,21 @@
 #define LICENSE "Licensed GPL v3+"
 #define REPO_URL "https://github.com/microsounds/akari-bbs"
 #define REVISION 14 /* revision no. */
-#define DB_VER 4
+#define DB_VER 16
 
 /* static resources
  * all anchor links should start with absolute / document root
+ * links and forms point at the binaries of the same build
  */
 #define DATABASE_LOC "db/database.sqlite3"
-#define BOARD_SCRIPT "/board.cgi"
-#define SUBMIT_SCRIPT "/submit.cgi"
+#ifdef FASTCGI
+	#define SCRIPT_EXT ".fcgi"
+#else
+	#define SCRIPT_EXT ".cgi"
+#endif
+#define BOARD_SCRIPT "/board" SCRIPT_EXT
+#define SUBMIT_SCRIPT "/submit" SCRIPT_EXT
+#define SEARCH_SCRIPT "/search" SCRIPT_EXT
 
 /* rotating banners */
 #define BANNER_COUNT 625
@@ -47,12 +54,28 @@
 #define MAX_REPLY_PREVIEW 5
 #define THREADS_PER_PAGE 15
 #define DAYS_TO_ARCHIVE 90
+#define ARCHIVE_PER_PAGE 50
+#define ARCHIVE_SUBJECT 30 /* OP characters shown in the archive */
+#define ARCHIVE_DIGEST 40
+#define CATALOG_DIGEST 120 /* OP characters shown in the catalog */
+#define SEARCH_PER_PAGE 20
+#define SEARCH_MAX_MATCHES 1000 /* newest matches ranked per search */
 #define REDIRECT_SEC 1
 
+/* comment markup
+ * bump when quote or [tag] markup changes, then run akari-render
+ * until then older posts are rendered on every view
+ */
+#define MARKUP_VER 2
+
 /* user flooding limits */
 #define COOLDOWN_SEC 30
 #define IDENTICAL_POST_SEC 300
+#define IDENTICAL_TEXT_SEC 0 /* same text from any IP, 0 to disable */
 #define MAX_THREADS_PER_IP 5
+#define RATELIMIT_LOC "db/ratelimit.shm" /* shared cooldown table */
+#define RATELIMIT_SLOTS 4096 /* power of 2 */
+#define RATELIMIT_PROBES 8
 
 /* software limits */
 #define POST_MAX_PAYLOAD 10000
@@ -60,7 +83,25 @@
 #define OPTIONS_MAX_LENGTH 30
 #define SUBJECT_MAX_LENGTH 75
 #define COMMENT_MAX_LENGTH 2000
-#define INSERT_MAX_RETRIES 10
-#define FETCH_MAX_RETRIES 50
+#define SEARCH_MAX_LENGTH 100
+
+/* database connection */
+#define BUSY_TIMEOUT_MS 5000 /* wait for a lock */
+#define BUSY_MAX_SLEEP_MS 100 /* backoff ceiling */
+#define DB_MMAP_SIZE 67108864 /* 64 MiB */
+#define DB_CACHE_KIB 8192
+
+/* akari-maint */
+#define MAINT_BATCH 10 /* expired threads per transaction */
+#define MAINT_PAUSE_MS 50 /* between write transactions */
+#define MAINT_VACUUM_PAGES 256 /* free pages returned per transaction */
+#define MAINT_MERGE_PAGES 500 /* search index pages merged per transaction */
+
+/* akari-restore */
+#define RESTORE_BATCH 100000 /* records per transaction */
+#define RESTORE_CACHE_KIB 65536
+
+/* akari-render */
+#define RENDER_BATCH 1000 /* posts per transaction */
 
 #endif
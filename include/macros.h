@@ -28,4 +28,19 @@
  */
 #define getenv_s(x) ((!getenv(x) || !*getenv(x)) ? NULL : getenv(x))
 
+/* request loop */
+/* FastCGI builds replace stdio with libfcgi's drop-in wrappers and
+ * serve requests until the server shuts them down, plain CGI builds
+ * run the loop body exactly once
+ * usage:
+	unsigned n;
+	request_loop(n) { ... }
+ */
+#ifdef FASTCGI
+	#include <fcgi_stdio.h>
+	#define request_loop(n) for (n = 0; FCGI_Accept() >= 0; n++)
+#else
+	#define request_loop(n) for (n = 0; n < 1; n++)
+#endif
+
 #endif
@@ -0,0 +1,34 @@
+#ifndef MARKUP_H
+#define MARKUP_H
+
+/* comment markup
+ * comments are rendered once by submit.c and stored alongside the
+ * original text, MARKUP_VER in global.h tags which rules produced them
+ */
+
+/* linkquotes of one or more comments, resolved to their threads */
+struct linkquote {
+	char *board_id;
+	long id;
+	long parent_id; /* 0 if the post doesn't exist */
+};
+
+struct quotelist {
+	unsigned count;
+	unsigned capacity;
+	struct linkquote *arr;
+};
+
+unsigned markup_quotes(struct quotelist *ql, const char *comment, const char *board_id);
+int markup_resolve(sqlite3 *db, struct quotelist *ql);
+void markup_quotes_free(struct quotelist *ql);
+int markup_store_quotes(sqlite3 *db, const struct quotelist *ql, const char *comment,
+                        const char *board_id, const long id, const long parent_id);
+
+char *enquote_comment(char **loc, const char *board_id, const long parent_id, const struct quotelist *ql);
+char *format_comment(char **loc);
+char *markup_render(const char *comment, const char *board_id, const long parent_id,
+                    const struct quotelist *ql);
+int markup_rebuild(sqlite3 *db, const char *board_id, long *cursor, long *count);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+/* shared memory post cooldown table
+ * a fixed number of slots mapped from RATELIMIT_LOC, shared by every
+ * submit process, holding the last post time of recently seen IPs
+ */
+#ifdef NDEBUG
+long ratelimit_cooldown(const char *ip_addr, long now);
+void ratelimit_record(const char *ip_addr, long now);
+#else
+#define ratelimit_cooldown(ip_addr, now) -1
+#define ratelimit_record(ip_addr, now)
+#endif
+
+#endif
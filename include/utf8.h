@@ -8,14 +8,15 @@ extern const char *const escape[]; /* static strings */
 #define base16(c) base16[(unsigned char) (c)]
 #define wspace(c) wspace[(unsigned char) (c)]
 #define escape(c) escape[(unsigned char) (c)]
+#define ESCAPE_MAX 6 /* longest escape code */
 
 /* format tags */
 extern const char *const fmt[];
 enum format_tag {
 	SPOILER_L, SPOILER_R,
 	CODE_L, CODE_R,
-	/* [code] must come last
-	 * this is enforced by static assert
+	/* left tag, then right tag
+	 * markup of each pair is in format_comment()
 	 */
 	SUPPORTED_TAGS /* total count */
 };
@@ -38,7 +39,9 @@ char *utf8_truncate(const char *src, size_t n);
 const char *time_human(size_t sec);
 char *strip_whitespace(char *str);
 char *xss_sanitize(char **loc);
+char *xss_truncate(const char *src, size_t n);
 int spam_filter(const char *str);
+long text_fingerprint(const char *str);
 
 /* tripcode routines */
 char *tripcode_pass(char **nameptr);
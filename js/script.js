@@ -73,49 +73,37 @@ function highlight(request)
 	}
 }
 
-function popup(self, request, hover)
+function popup(link, request, hover)
 {
-	/* displays quoted post on hover */
+	/* displays quoted post on hover
+	 * dead links are struck out by the server, quoted posts
+	 * that aren't on this page have nothing to display
+	 */
 	var orig = document.getElementById(request);
-	var visible = (!orig) ? 0 : is_visible(orig);
-	var parent = document.getElementById(self);
-	var linkquote = parent.getElementsByClassName("linkquote");
-	for (var i in linkquote)
+	if (!orig)
+		return;
+	var visible = is_visible(orig);
+	if (hover)
 	{
-		var current = linkquote[i];
-		var href = current.getAttribute("href");
-		if (!strcmp(href, "#" + request))
+		if (!visible) /* display in viewport */
 		{
-			if (!orig) /* post doesn't exist */
-			{
-				current.removeAttribute("onmouseover");
-				current.removeAttribute("onmouseout");
-				current.setAttribute("style", "text-decoration:line-through;");
-			}
-			else if (hover)
-			{
-				if (!visible) /* display in viewport */
-				{
-					var style = " popup";
-					var copy = orig.cloneNode(1); /* prevent id collision */
-					copy.setAttribute("id", copy.getAttribute("id") + "prev");
-					copy.setAttribute("class", copy.getAttribute("class") + style);
-					current.parentNode.insertBefore(copy, current.nextSibling);
-				}
-				else
-					highlight(request);
-			}
-			else
-			{
-				highlight(0); /* unset highlights */
-				if (!visible) /* remove from viewport */
-				{
-					var popup = document.getElementById(request + "prev");
-					if (popup)
-						popup.parentNode.removeChild(popup);
-				}
-			}
-			break;
+			var style = " popup";
+			var copy = orig.cloneNode(1); /* prevent id collision */
+			copy.setAttribute("id", copy.getAttribute("id") + "prev");
+			copy.setAttribute("class", copy.getAttribute("class") + style);
+			link.parentNode.insertBefore(copy, link.nextSibling);
+		}
+		else
+			highlight(request);
+	}
+	else
+	{
+		highlight(0); /* unset highlights */
+		if (!visible) /* remove from viewport */
+		{
+			var popup = document.getElementById(request + "prev");
+			if (popup)
+				popup.parentNode.removeChild(popup);
 		}
 	}
 }
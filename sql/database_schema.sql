@@ -1,6 +1,6 @@
 /*
  * database_schema.sql
- * akari-bbs database schema version 4
+ * akari-bbs database schema version 16
  */
 
 /*
@@ -29,13 +29,16 @@ CREATE TABLE banned_users (
 
  */
 
+PRAGMA auto_vacuum=INCREMENTAL; /* free pages returned by akari-maint */
 PRAGMA journal_mode=WAL; /* prevent busy DB errors */
+PRAGMA user_version=16; /* schema version */
 
 CREATE TABLE boards (
 	id        TEXT    PRIMARY KEY,
 	name      TEXT    NOT NULL,
 	desc      TEXT    NOT NULL,
-	status    INTEGER NOT NULL  /* board_status flags */
+	status    INTEGER NOT NULL, /* board_status flags */
+	post_seq  INTEGER NOT NULL DEFAULT 0 /* last assigned post id */
 );
 
 CREATE TABLE active_threads (
@@ -43,6 +46,7 @@ CREATE TABLE active_threads (
 	post_id   INTEGER NOT NULL,
 	last_bump INTEGER NOT NULL,
 	status    INTEGER NOT NULL,  /* thread_status flags */
+	ip        TEXT    NOT NULL DEFAULT '', /* OP, for MAX_THREADS_PER_IP */
 	PRIMARY KEY (board_id, post_id)
 );
 
@@ -50,9 +54,43 @@ CREATE TABLE archived_threads (
 	board_id  TEXT    NOT NULL,
 	post_id   INTEGER NOT NULL,
 	expiry    INTEGER NOT NULL,
+	replies   INTEGER NOT NULL DEFAULT 0, /* OP summary taken at archive time */
+	name      TEXT,
+	trip      TEXT,
+	subject   TEXT, /* digest */
+	comment   TEXT, /* digest */
+	PRIMARY KEY (board_id, post_id)
+);
+
+CREATE TABLE thread_stats (
+	board_id   TEXT    NOT NULL,
+	post_id    INTEGER NOT NULL,
+	replies    INTEGER NOT NULL,
+	last_post  INTEGER NOT NULL, /* newest post id */
+	posters    INTEGER NOT NULL, /* unique IPs, see thread_posters */
+	bump_limit INTEGER NOT NULL, /* non-zero if no longer bumped */
 	PRIMARY KEY (board_id, post_id)
 );
 
+CREATE TABLE thread_posters (
+	board_id  TEXT    NOT NULL,
+	post_id   INTEGER NOT NULL, /* parent thread */
+	ip        TEXT    NOT NULL,
+	PRIMARY KEY (board_id, post_id, ip)
+) WITHOUT ROWID;
+
+/* backlinks, one row for every post quoting another on the same board
+ * written with the quoting post's markup, see akari-render
+ */
+CREATE TABLE quotes (
+	board_id    TEXT    NOT NULL,
+	parent_id   INTEGER NOT NULL, /* thread of the quoted post */
+	post_id     INTEGER NOT NULL, /* quoted post */
+	from_parent INTEGER NOT NULL, /* thread of the quoting post */
+	from_id     INTEGER NOT NULL, /* quoting post */
+	PRIMARY KEY (board_id, parent_id, post_id, from_id)
+) WITHOUT ROWID;
+
 CREATE TABLE posts (
 	board_id  TEXT    NOT NULL,
 	parent_id INTEGER NOT NULL,
@@ -66,18 +104,78 @@ CREATE TABLE posts (
 	trip      TEXT,
 	subject   TEXT,
 	comment   TEXT    NOT NULL,
+	fingerprint INTEGER NOT NULL DEFAULT 0, /* duplicate detection */
+	rendered  TEXT, /* comment markup, see akari-render */
+	markup_ver INTEGER NOT NULL DEFAULT 0, /* MARKUP_VER of rendered */
 	PRIMARY KEY (board_id, id)
 );
 
+/* indexes
+ * every statement in database.c should be served by a primary
+ * key or one of these, check with make plan-check
+ */
+CREATE INDEX active_threads_bump ON active_threads (board_id, last_bump, post_id);
+CREATE INDEX active_threads_ip ON active_threads (board_id, ip); /* threads per IP */
+CREATE INDEX archived_threads_expiry ON archived_threads (board_id, expiry, post_id);
+CREATE INDEX posts_thread ON posts (board_id, parent_id, id); /* thread fetch */
+CREATE INDEX posts_ip ON posts (ip, time); /* flood control */
+CREATE INDEX posts_fingerprint ON posts (fingerprint, time); /* duplicate posts */
+CREATE INDEX quotes_from ON quotes (board_id, from_parent, from_id); /* deletion */
+
+/* full-text search
+ * external content index over posts_text, kept current by the triggers below
+ * posts keep comments HTML-escaped, posts_text undoes the escape codes so
+ * they aren't indexed as words, and drops the \x01 and \x02 bytes search.cgi
+ * uses to mark highlighted terms
+ * board_id is stored unindexed, board filters compare posts.board_id
+ * rows are matched to posts by rowid, which a full VACUUM may renumber,
+ * rebuild afterwards with INSERT INTO posts_search(posts_search) VALUES('rebuild');
+ */
+CREATE VIEW posts_text (id, board_id, subject, comment) AS
+	SELECT rowid, board_id,
+		replace(replace(replace(replace(replace(replace(replace(replace(subject,
+			char(1), ''), char(2), ''), '&#013;', char(10)), '&lt;', '<'), '&gt;', '>'),
+			'&quot;', '"'), '&apos;', ''''), '&amp;', '&'),
+		replace(replace(replace(replace(replace(replace(replace(replace(comment,
+			char(1), ''), char(2), ''), '&#013;', char(10)), '&lt;', '<'), '&gt;', '>'),
+			'&quot;', '"'), '&apos;', ''''), '&amp;', '&')
+	FROM posts;
+CREATE VIRTUAL TABLE posts_search USING fts5 (
+	board_id UNINDEXED, subject, comment,
+	content='posts_text', content_rowid='id',
+	tokenize='unicode61 remove_diacritics 2'
+);
+CREATE TRIGGER posts_search_insert AFTER INSERT ON posts BEGIN
+	INSERT INTO posts_search (rowid, board_id, subject, comment)
+		SELECT id, board_id, subject, comment FROM posts_text WHERE id = new.rowid;
+END;
+CREATE TRIGGER posts_search_delete BEFORE DELETE ON posts BEGIN
+	INSERT INTO posts_search (posts_search, rowid, board_id, subject, comment)
+		SELECT 'delete', id, board_id, subject, comment FROM posts_text WHERE id = old.rowid;
+END;
+CREATE TRIGGER posts_search_unindex BEFORE UPDATE OF subject, comment ON posts BEGIN
+	INSERT INTO posts_search (posts_search, rowid, board_id, subject, comment)
+		SELECT 'delete', id, board_id, subject, comment FROM posts_text WHERE id = old.rowid;
+END;
+CREATE TRIGGER posts_search_reindex AFTER UPDATE OF subject, comment ON posts BEGIN
+	INSERT INTO posts_search (rowid, board_id, subject, comment)
+		SELECT id, board_id, subject, comment FROM posts_text WHERE id = new.rowid;
+END;
+
 INSERT INTO boards VALUES
-("test", "Dummy Board", "Dummy board for feature testing.", 0),
-("meta", "Akari-BBS Discussion", "Meta Discussion goes here.", 0);
+("test", "Dummy Board", "Dummy board for feature testing.", 0, 5),
+("meta", "Akari-BBS Discussion", "Meta Discussion goes here.", 0, 0);
+
+INSERT INTO active_threads VALUES ("test", 1, 1, 0, "192.168.1.1");
+INSERT INTO thread_stats VALUES ("test", 1, 4, 5, 5, 0);
 
-INSERT INTO active_threads VALUES ("test", 1, 1, 0);
+INSERT INTO thread_posters VALUES
+("test", 1, "192.168.1.1"), ("test", 1, "127.0.0.1"), ("test", 1, "39.39.39.39"),
+("test", 1, "1.1.1.1"), ("test", 1, "2.2.2.2");
 
 INSERT INTO posts VALUES
-("test", 1, 1, 1471893064, 0, 1, "dummy", "192.168.1.1", NULL, NULL, NULL, "This is a sample comment!"),
-("test", 1, 2, 1371293064, 0, 1, "dummy", "127.0.0.1", NULL, NULL, NULL, "This is comment #2"),
-("test", 1, 3, 1271493064, 0, 1, "dummy", "39.39.39.39", NULL, NULL, NULL, "Another comment."),
-("test", 1, 4, 1171892064, 0, 1, "dummy", "1.1.1.1", NULL, NULL, NULL, "This board sucks, lol."),
-("test", 1, 5, 1471813064, 0, 1, "dummy", "2.2.2.2", NULL, NULL, NULL, "dickbutt");
+("test", 1, 1, 1471893064, 0, 1, "dummy", "192.168.1.1", NULL, NULL, NULL, "This is a sample comment!", 0, NULL, 0),
+("test", 1, 2, 1371293064, 0, 1, "dummy", "127.0.0.1", NULL, NULL, NULL, "This is comment #2", 0, NULL, 0),
+("test", 1, 3, 1271493064, 0, 1, "dummy", "39.39.39.39", NULL, NULL, NULL, "Another comment.", 0, NULL, 0),
+("test", 1, 4, 1171892064, 0, 1, "dummy", "1.1.1.1", NULL, NULL, NULL, "This board sucks, lol.", 0, NULL, 0),
+("test", 1, 5, 1471813064, 0, 1, "dummy", "2.2.2.2", NULL, NULL, NULL, "dickbutt", 0, NULL, 0);
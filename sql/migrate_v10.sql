@@ -0,0 +1,12 @@
+/*
+ * migrate_v10.sql
+ * automated migration from version 9 to version 10
+ * records the OP's IP on active threads for per-IP thread limits
+ */
+
+ALTER TABLE active_threads ADD COLUMN ip TEXT NOT NULL DEFAULT '';
+UPDATE active_threads SET ip = IFNULL((SELECT ip FROM posts
+	WHERE posts.board_id = active_threads.board_id
+	AND posts.id = active_threads.post_id), '');
+CREATE INDEX active_threads_ip ON active_threads (board_id, ip);
+PRAGMA user_version=10;
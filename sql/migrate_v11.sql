@@ -0,0 +1,10 @@
+/*
+ * migrate_v11.sql
+ * automated migration from version 10 to version 11
+ * enables incremental vacuum for akari-maint, auto_vacuum can only be
+ * changed by rebuilding the database with VACUUM, which may take a while
+ */
+
+PRAGMA auto_vacuum=INCREMENTAL;
+VACUUM;
+PRAGMA user_version=11;
@@ -0,0 +1,34 @@
+/*
+ * migrate_v12.sql
+ * automated migration from version 11 to version 12
+ * adds the full-text search index used by search.cgi and indexes
+ * every existing post
+ */
+
+/* full-text search
+ * external content index over posts, kept current by the triggers below
+ * board_id is indexed so board filters are part of the MATCH expression
+ * rows are matched to posts by rowid, which a full VACUUM may renumber,
+ * rebuild afterwards with INSERT INTO posts_search(posts_search) VALUES('rebuild');
+ */
+CREATE VIRTUAL TABLE posts_search USING fts5 (
+	board_id, subject, comment,
+	content='posts', content_rowid='rowid',
+	tokenize='unicode61 remove_diacritics 2'
+);
+CREATE TRIGGER posts_search_insert AFTER INSERT ON posts BEGIN
+	INSERT INTO posts_search (rowid, board_id, subject, comment)
+		VALUES (new.rowid, new.board_id, new.subject, new.comment);
+END;
+CREATE TRIGGER posts_search_delete AFTER DELETE ON posts BEGIN
+	INSERT INTO posts_search (posts_search, rowid, board_id, subject, comment)
+		VALUES ('delete', old.rowid, old.board_id, old.subject, old.comment);
+END;
+CREATE TRIGGER posts_search_update AFTER UPDATE OF subject, comment ON posts BEGIN
+	INSERT INTO posts_search (posts_search, rowid, board_id, subject, comment)
+		VALUES ('delete', old.rowid, old.board_id, old.subject, old.comment);
+	INSERT INTO posts_search (rowid, board_id, subject, comment)
+		VALUES (new.rowid, new.board_id, new.subject, new.comment);
+END;
+INSERT INTO posts_search (posts_search) VALUES ('rebuild');
+PRAGMA user_version=12;
@@ -0,0 +1,11 @@
+/*
+ * migrate_v13.sql
+ * automated migration from version 12 to version 13
+ * adds stored comment markup, rendered by submit.c at post time
+ * existing posts have none and are rendered on every view
+ * until akari-render is run
+ */
+
+ALTER TABLE posts ADD COLUMN rendered TEXT;
+ALTER TABLE posts ADD COLUMN markup_ver INTEGER NOT NULL DEFAULT 0;
+PRAGMA user_version=13;
@@ -0,0 +1,19 @@
+/*
+ * migrate_v14.sql
+ * automated migration from version 13 to version 14
+ * adds backlinks, the posts quoting each post
+ * existing posts are marked for rendering again, run akari-render
+ * afterwards to record their backlinks
+ */
+
+CREATE TABLE quotes (
+	board_id    TEXT    NOT NULL,
+	parent_id   INTEGER NOT NULL, /* thread of the quoted post */
+	post_id     INTEGER NOT NULL, /* quoted post */
+	from_parent INTEGER NOT NULL, /* thread of the quoting post */
+	from_id     INTEGER NOT NULL, /* quoting post */
+	PRIMARY KEY (board_id, parent_id, post_id, from_id)
+) WITHOUT ROWID;
+CREATE INDEX quotes_from ON quotes (board_id, from_parent, from_id);
+UPDATE posts SET markup_ver = 0;
+PRAGMA user_version=14;
@@ -0,0 +1,11 @@
+/*
+ * migrate_v15.sql
+ * automated migration from version 14 to version 15
+ * duplicate post index leads with time after the fingerprint so
+ * cross-IP duplicate checks range on time instead of reading every
+ * post with the same text
+ */
+
+DROP INDEX posts_fingerprint;
+CREATE INDEX posts_fingerprint ON posts (fingerprint, time);
+PRAGMA user_version=15;
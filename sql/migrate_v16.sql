@@ -0,0 +1,54 @@
+/*
+ * migrate_v16.sql
+ * automated migration from version 15 to version 16
+ * the search index is rebuilt over unescaped text, escape codes were
+ * indexed as the words gt, quot, amp and 013
+ * board_id is no longer indexed, board filters compare posts.board_id
+ */
+
+DROP TRIGGER posts_search_insert;
+DROP TRIGGER posts_search_delete;
+DROP TRIGGER posts_search_update;
+DROP TABLE posts_search;
+
+/* full-text search
+ * external content index over posts_text, kept current by the triggers below
+ * posts keep comments HTML-escaped, posts_text undoes the escape codes so
+ * they aren't indexed as words, and drops the \x01 and \x02 bytes search.cgi
+ * uses to mark highlighted terms
+ * board_id is stored unindexed, board filters compare posts.board_id
+ * rows are matched to posts by rowid, which a full VACUUM may renumber,
+ * rebuild afterwards with INSERT INTO posts_search(posts_search) VALUES('rebuild');
+ */
+CREATE VIEW posts_text (id, board_id, subject, comment) AS
+	SELECT rowid, board_id,
+		replace(replace(replace(replace(replace(replace(replace(replace(subject,
+			char(1), ''), char(2), ''), '&#013;', char(10)), '&lt;', '<'), '&gt;', '>'),
+			'&quot;', '"'), '&apos;', ''''), '&amp;', '&'),
+		replace(replace(replace(replace(replace(replace(replace(replace(comment,
+			char(1), ''), char(2), ''), '&#013;', char(10)), '&lt;', '<'), '&gt;', '>'),
+			'&quot;', '"'), '&apos;', ''''), '&amp;', '&')
+	FROM posts;
+CREATE VIRTUAL TABLE posts_search USING fts5 (
+	board_id UNINDEXED, subject, comment,
+	content='posts_text', content_rowid='id',
+	tokenize='unicode61 remove_diacritics 2'
+);
+CREATE TRIGGER posts_search_insert AFTER INSERT ON posts BEGIN
+	INSERT INTO posts_search (rowid, board_id, subject, comment)
+		SELECT id, board_id, subject, comment FROM posts_text WHERE id = new.rowid;
+END;
+CREATE TRIGGER posts_search_delete BEFORE DELETE ON posts BEGIN
+	INSERT INTO posts_search (posts_search, rowid, board_id, subject, comment)
+		SELECT 'delete', id, board_id, subject, comment FROM posts_text WHERE id = old.rowid;
+END;
+CREATE TRIGGER posts_search_unindex BEFORE UPDATE OF subject, comment ON posts BEGIN
+	INSERT INTO posts_search (posts_search, rowid, board_id, subject, comment)
+		SELECT 'delete', id, board_id, subject, comment FROM posts_text WHERE id = old.rowid;
+END;
+CREATE TRIGGER posts_search_reindex AFTER UPDATE OF subject, comment ON posts BEGIN
+	INSERT INTO posts_search (rowid, board_id, subject, comment)
+		SELECT id, board_id, subject, comment FROM posts_text WHERE id = new.rowid;
+END;
+INSERT INTO posts_search (posts_search) VALUES ('rebuild');
+PRAGMA user_version=16;
@@ -0,0 +1,13 @@
+/*
+ * migrate_v5.sql
+ * automated migration from version 4 to version 5
+ * adds indexes for thread fetches, index ranking, archive listing
+ * and flood control, existing data is left untouched
+ */
+
+CREATE INDEX IF NOT EXISTS active_threads_bump ON active_threads (board_id, last_bump, post_id);
+CREATE INDEX IF NOT EXISTS archived_threads_expiry ON archived_threads (board_id, expiry, post_id);
+CREATE INDEX IF NOT EXISTS posts_thread ON posts (board_id, parent_id, id);
+CREATE INDEX IF NOT EXISTS posts_ip ON posts (ip, time);
+PRAGMA user_version=5;
+ANALYZE;
@@ -0,0 +1,10 @@
+/*
+ * migrate_v6.sql
+ * automated migration from version 5 to version 6
+ * adds per-board post id sequence, seeded from existing posts
+ */
+
+ALTER TABLE boards ADD COLUMN post_seq INTEGER NOT NULL DEFAULT 0;
+UPDATE boards SET post_seq =
+	(SELECT IFNULL(MAX(id), 0) FROM posts WHERE board_id = boards.id);
+PRAGMA user_version=6;
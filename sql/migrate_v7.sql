@@ -0,0 +1,20 @@
+/*
+ * migrate_v7.sql
+ * automated migration from version 6 to version 7
+ * adds thread summaries to archived_threads, filled in from existing posts
+ * summaries keep ARCHIVE_SUBJECT and ARCHIVE_DIGEST times ESCAPE_MAX characters
+ */
+
+ALTER TABLE archived_threads ADD COLUMN replies INTEGER NOT NULL DEFAULT 0;
+ALTER TABLE archived_threads ADD COLUMN name TEXT;
+ALTER TABLE archived_threads ADD COLUMN trip TEXT;
+ALTER TABLE archived_threads ADD COLUMN subject TEXT;
+ALTER TABLE archived_threads ADD COLUMN comment TEXT;
+UPDATE archived_threads SET
+	replies = (SELECT COUNT(*) - 1 FROM posts
+		WHERE posts.board_id = archived_threads.board_id
+		AND posts.parent_id = archived_threads.post_id),
+	(name, trip, subject, comment) = (SELECT name, trip, substr(subject, 1, 180), substr(comment, 1, 240)
+		FROM posts WHERE posts.board_id = archived_threads.board_id
+		AND posts.id = archived_threads.post_id);
+PRAGMA user_version=7;
@@ -0,0 +1,30 @@
+/*
+ * migrate_v8.sql
+ * automated migration from version 7 to version 8
+ * adds incrementally maintained thread statistics, built from existing posts
+ * replace 300 with THREAD_BUMP_LIMIT if it was changed in global.h
+ */
+
+CREATE TABLE thread_stats (
+	board_id   TEXT    NOT NULL,
+	post_id    INTEGER NOT NULL,
+	replies    INTEGER NOT NULL,
+	last_post  INTEGER NOT NULL,
+	posters    INTEGER NOT NULL,
+	bump_limit INTEGER NOT NULL,
+	PRIMARY KEY (board_id, post_id)
+);
+
+CREATE TABLE thread_posters (
+	board_id  TEXT    NOT NULL,
+	post_id   INTEGER NOT NULL,
+	ip        TEXT    NOT NULL,
+	PRIMARY KEY (board_id, post_id, ip)
+) WITHOUT ROWID;
+
+INSERT INTO thread_posters
+	SELECT DISTINCT board_id, parent_id, ip FROM posts;
+INSERT INTO thread_stats
+	SELECT board_id, parent_id, COUNT(*) - 1, MAX(id), COUNT(DISTINCT ip), COUNT(*) > 300
+	FROM posts GROUP BY board_id, parent_id;
+PRAGMA user_version=8;
@@ -0,0 +1,11 @@
+/*
+ * migrate_v9.sql
+ * automated migration from version 8 to version 9
+ * adds comment fingerprints for duplicate post detection
+ * existing posts keep a fingerprint of 0, they are older than any
+ * duplicate post window and never need to be matched
+ */
+
+ALTER TABLE posts ADD COLUMN fingerprint INTEGER NOT NULL DEFAULT 0;
+CREATE INDEX posts_fingerprint ON posts (fingerprint, ip, time);
+PRAGMA user_version=9;
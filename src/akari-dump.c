@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+#include "global.h"
+#include "database.h"
+#include "dump.h"
+#include "macros.h"
+
+/*
+ * [maintenance]
+ * akari-dump.c
+ * stream a board to stdout, see dump.h for the format
+ */
+
+/* USAGE:
+ * akari-dump <board> > board.dump
+ * must be run from the document root, reads a consistent snapshot
+ * without blocking posting, memory use doesn't grow with board size
+ */
+
+static char *line = NULL; /* record buffer */
+static size_t capacity = 0;
+
+static void reserve(size_t used, const char *str)
+{
+	/* grow record buffer to fit another escaped field */
+	size_t need = used + ((!str) ? 0 : strlen(str) * 2) + 4;
+	if (need > capacity)
+	{
+		capacity = need * 2;
+		line = (char *) realloc(line, capacity);
+	}
+}
+
+static int dump_records(sqlite3 *db, enum statement id, const char *type, const char *board_id, long *rows)
+{
+	/* write one record per row of a dump statement
+	 * integer columns are written as is, text columns escaped
+	 * returns error code
+	 */
+	sqlite3_stmt *stmt = db_statement(db, id, board_id);
+	if (!stmt)
+		return sqlite3_errcode(db);
+	int err, i, cols = sqlite3_column_count(stmt);
+	*rows = 0;
+	while ((err = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		reserve(0, type);
+		size_t len = sprintf(line, "%s", type);
+		for (i = 0; i < cols; i++)
+		{
+			if (sqlite3_column_type(stmt, i) == SQLITE_INTEGER)
+			{
+				reserve(len, "-9223372036854775808");
+				len += sprintf(&line[len], "\t%ld", (long) sqlite3_column_int64(stmt, i));
+			}
+			else
+			{
+				const char *text = (const char *) sqlite3_column_text(stmt, i);
+				reserve(len, text);
+				len += dump_escape(&line[len], text);
+			}
+		}
+		line[len++] = '\n';
+		fwrite(line, 1, len, stdout);
+		(*rows)++;
+	}
+	sqlite3_reset(stmt);
+	return (err == SQLITE_DONE) ? 0 : err;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 2)
+	{
+		fprintf(stderr, "usage: akari-dump <board> > board.dump\n");
+		return 1;
+	}
+	const char *board_id = argv[1];
+	int err;
+	sqlite3 *db;
+	if ((err = db_open(&db, SQLITE_OPEN_READONLY)))
+	{
+		fprintf(stderr, "akari-dump: cannot open database. (e%d: %s)\n", err, sqlite3_err[err]);
+		return 1;
+	}
+	/* board, threads and posts, all from the same snapshot */
+	static const struct {
+		enum statement id;
+		const char *type;
+	} record[] = {
+		{ SQL_DUMP_BOARD, "B" }, { SQL_DUMP_ACTIVE, "A" },
+		{ SQL_DUMP_ARCHIVED, "X" }, { SQL_DUMP_POSTS, "P" }
+	};
+	long rows[static_size(record)] = { 0 };
+	unsigned i;
+	if (!(err = sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL)))
+	{
+		fprintf(stdout, "akari-dump\t%d\n", DUMP_VER);
+		for (i = 0; i < static_size(record) && !err; i++)
+		{
+			err = dump_records(db, record[i].id, record[i].type, board_id, &rows[i]);
+			if (!err && !rows[0])
+			{
+				fprintf(stderr, "akari-dump: /%s/ doesn't exist.\n", board_id);
+				err = SQLITE_NOTFOUND;
+			}
+		}
+		sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+	}
+	if (fflush(stdout))
+	{
+		perror("akari-dump");
+		err = SQLITE_IOERR;
+	}
+	else if (err && err != SQLITE_NOTFOUND)
+		fprintf(stderr, "akari-dump: %s. (e%d: %s)\n", sqlite3_errmsg(db), err, sqlite3_err[err]);
+	else if (!err)
+		fprintf(stderr, "akari-dump: /%s/ %ld active, %ld archived threads, %ld posts\n",
+		        board_id, rows[1], rows[2], rows[3]);
+	free(line);
+	db_close(db);
+	return !!err;
+}
@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+#include "global.h"
+#include "database.h"
+#include "utf8.h"
+#include "macros.h"
+
+/*
+ * [maintenance]
+ * akari-maint.c
+ * housekeeping kept off the request path: archive pruning, expiry,
+ * search index merging, incremental vacuum, ANALYZE and WAL checkpoints
+ */
+
+/* USAGE:
+ * akari-maint            run once, eg. from cron
+ * akari-maint <seconds>  run every n seconds until killed
+ * must be run from the document root as the database owner
+ */
+
+static long pragma_value(sqlite3 *db, const char *sql)
+{
+	/* returns first value from first row of a PRAGMA */
+	sqlite3_stmt *stmt;
+	long value = 0;
+	if (!sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) && sqlite3_step(stmt) == SQLITE_ROW)
+		value = sqlite3_column_int64(stmt, 0);
+	sqlite3_finalize(stmt);
+	return value;
+}
+
+static int prune_boards(sqlite3 *db, const struct board *list)
+{
+	/* archive stale threads and delete expired ones on every board
+	 * expiry is split into transactions of MAINT_BATCH threads
+	 * returns error code
+	 */
+	int err = 0;
+	unsigned i;
+	for (i = 0; i < list->count && !err; i++)
+	{
+		const char *board_id = list->arr[i].id;
+		long archived = 0, expired = 0, total = 0;
+		if (!(err = db_begin(db)) && !(err = db_archive_oldest(db, board_id, &archived)))
+			err = db_commit(db);
+		while (!err)
+		{
+			if (!(err = db_begin(db)) && !(err = db_expire_oldest(db, board_id, MAINT_BATCH, &expired)))
+				err = db_commit(db);
+			if (!err)
+				total += expired;
+			if (err || expired < MAINT_BATCH)
+				break;
+			db_pause(MAINT_PAUSE_MS);
+		}
+		db_rollback(db);
+		if (archived || total)
+			fprintf(stdout, "akari-maint: /%s/ %ld archived, %ld expired\n", board_id, archived, total);
+	}
+	return err;
+}
+
+static int vacuum(sqlite3 *db)
+{
+	/* return free pages to the filesystem, MAINT_VACUUM_PAGES at a time
+	 * requires auto_vacuum=INCREMENTAL, see database_schema.sql
+	 * returns error code
+	 */
+	if (pragma_value(db, "PRAGMA auto_vacuum;") != 2) /* INCREMENTAL */
+		return 0;
+	char sql[64];
+	sprintf(sql, "PRAGMA incremental_vacuum(%d);", MAINT_VACUUM_PAGES);
+	int err = 0;
+	long freed = 0, pages, last = 0;
+	while ((pages = pragma_value(db, "PRAGMA freelist_count;")) > 0 && pages != last)
+	{
+		if ((err = sqlite3_exec(db, sql, NULL, NULL, NULL)))
+			break;
+		freed += min(pages, MAINT_VACUUM_PAGES);
+		last = pages;
+		db_pause(MAINT_PAUSE_MS);
+	}
+	if (freed)
+		fprintf(stdout, "akari-maint: %ld pages vacuumed\n", freed);
+	return err;
+}
+
+static int merge_search(sqlite3 *db)
+{
+	/* merge search index segments left behind by posting,
+	 * MAINT_MERGE_PAGES at a time, keeping the number of segments
+	 * each search has to read small as the index grows
+	 * returns error code
+	 */
+	char sql[96];
+	sprintf(sql, "INSERT INTO posts_search (posts_search, rank) VALUES ('merge', %d);",
+	        MAINT_MERGE_PAGES);
+	int err = 0;
+	long changes;
+	do
+	{
+		changes = sqlite3_total_changes(db);
+		if ((err = sqlite3_exec(db, sql, NULL, NULL, NULL)))
+			break;
+		changes = sqlite3_total_changes(db) - changes;
+		db_pause(MAINT_PAUSE_MS);
+	} while (changes >= 2); /* less than 2 means nothing left to merge */
+	return err;
+}
+
+static int checkpoint(sqlite3 *db)
+{
+	/* copy the WAL back into the database without blocking anyone
+	 * once fully copied, truncate it, giving up quickly if readers
+	 * are still using it since new writers wait on a pending truncate
+	 * returns error code
+	 */
+	int log, done;
+	int err = sqlite3_wal_checkpoint_v2(db, NULL, SQLITE_CHECKPOINT_PASSIVE, &log, &done);
+	if (!err && log > 0 && log == done)
+	{
+		db_busy_timeout(db, MAINT_PAUSE_MS);
+		err = sqlite3_wal_checkpoint_v2(db, NULL, SQLITE_CHECKPOINT_TRUNCATE, &log, &done);
+		db_busy_timeout(db, BUSY_TIMEOUT_MS);
+		if (err == SQLITE_BUSY) /* try again next run */
+			err = 0;
+	}
+	return err;
+}
+
+int main(int argc, char **argv)
+{
+	long interval = (argc > 1) ? atoi_s(argv[1]) : 0;
+	int err;
+	sqlite3 *db;
+	if ((err = db_open(&db, SQLITE_OPEN_READWRITE)))
+	{
+		fprintf(stderr, "akari-maint: cannot open database. (e%d: %s)\n", err, sqlite3_err[err]);
+		return 1;
+	}
+	do
+	{
+		struct board list;
+		db_board_fetch(db, &list);
+		if (!(err = prune_boards(db, &list)) && !(err = merge_search(db)) && !(err = vacuum(db)))
+		{
+			/* ANALYZE only tables that changed enough, sampling a bounded
+			 * number of rows per index
+			 */
+			if (!(err = sqlite3_exec(db, "PRAGMA analysis_limit=400;"
+			                             "PRAGMA optimize=0x10002;", NULL, NULL, NULL)))
+				err = checkpoint(db);
+		}
+		if (err)
+			fprintf(stderr, "akari-maint: %s. (e%d: %s)\n",
+			        sqlite3_errmsg(db), err, sqlite3_err[err]);
+		db_board_free(&list);
+		db_lock_report("akari-maint");
+		if (interval > 0)
+		{
+			fflush(stdout);
+			db_pause(interval * 1000);
+		}
+	} while (interval > 0);
+	db_close(db);
+	return !!err;
+}
@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <sqlite3.h>
+#include "global.h"
+#include "database.h"
+#include "markup.h"
+#include "macros.h"
+
+/*
+ * [maintenance]
+ * akari-render.c
+ * rebuild stored comment markup after MARKUP_VER changes
+ */
+
+/* USAGE:
+ * akari-render  render every post not rendered with the current MARKUP_VER
+ * must be run from the document root as the database owner, posts are
+ * rendered RENDER_BATCH at a time so posting isn't blocked for long,
+ * can be interrupted and run again
+ */
+
+int main(void)
+{
+	int err;
+	sqlite3 *db;
+	if ((err = db_open(&db, SQLITE_OPEN_READWRITE)))
+	{
+		fprintf(stderr, "akari-render: cannot open database. (e%d: %s)\n", err, sqlite3_err[err]);
+		return 1;
+	}
+	long cursor = 0, count = 0, total = 0;
+	do
+	{
+		if (!(err = db_begin(db)) && !(err = markup_rebuild(db, NULL, &cursor, &count)))
+			err = db_commit(db);
+		if (err)
+			db_rollback(db);
+		else
+			total += count;
+		if (!err && count == RENDER_BATCH)
+			db_pause(MAINT_PAUSE_MS);
+	} while (!err && count == RENDER_BATCH);
+
+	if (err)
+		fprintf(stderr, "akari-render: %s. (e%d: %s)\n", sqlite3_errmsg(db), err, sqlite3_err[err]);
+	fprintf(stderr, "akari-render: %ld posts rendered with markup version %d\n", total, MARKUP_VER);
+	db_lock_report("akari-render");
+	db_close(db);
+	return !!err;
+}
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+#include "global.h"
+#include "database.h"
+#include "utf8.h"
+#include "markup.h"
+#include "dump.h"
+#include "macros.h"
+
+/*
+ * [maintenance]
+ * akari-restore.c
+ * load a board from akari-dump output on stdin
+ */
+
+/* USAGE:
+ * akari-restore < board.dump          restore under the dumped board id
+ * akari-restore <board> < board.dump  restore under another board id
+ * the board must not exist yet, a failed restore removes what it loaded
+ * comment markup is rendered once every post is in place
+ * must be run from the document root as the database owner
+ */
+
+static char *read_record(char **buf, size_t *capacity)
+{
+	/* read one line of any length into a growable buffer
+	 * returns NULL on end of input
+	 */
+	size_t len = 0;
+	if (!*buf)
+	{
+		*capacity = 4096;
+		*buf = (char *) malloc(*capacity);
+	}
+	while (fgets(&(*buf)[len], *capacity - len, stdin))
+	{
+		len += strlen(&(*buf)[len]);
+		if ((*buf)[len - 1] == '\n')
+			return *buf;
+		*capacity *= 2;
+		*buf = (char *) realloc(*buf, *capacity);
+	}
+	return (len) ? *buf : NULL;
+}
+
+static int number(const char *str, long *n)
+{
+	/* parse integer field
+	 * returns non-zero if str isn't an integer
+	 */
+	char *end;
+	if (!str || !*str)
+		return 1;
+	*n = strtol(str, &end, 10);
+	return !!*end;
+}
+
+static int restore_record(sqlite3 *db, const char *board_id, char **f, unsigned count)
+{
+	/* insert a single thread or post record
+	 * returns error code, SQLITE_MISMATCH if malformed
+	 */
+	long n[6];
+	unsigned i;
+	switch (*f[0])
+	{
+		case 'A': /* post_id last_bump status ip */
+			if (count != 5)
+				break;
+			for (i = 0; i < 3; i++)
+				if (number(f[i + 1], &n[i]))
+					return SQLITE_MISMATCH;
+			return db_transaction(db, SQL_RESTORE_ACTIVE, board_id, n[0], n[1], n[2], f[4]);
+		case 'X': /* post_id expiry replies name trip subject comment */
+			if (count != 8)
+				break;
+			for (i = 0; i < 3; i++)
+				if (number(f[i + 1], &n[i]))
+					return SQLITE_MISMATCH;
+			return db_transaction(db, SQL_RESTORE_ARCHIVED, board_id, n[0], n[1], n[2],
+			                      f[4], f[5], f[6], f[7]);
+		case 'P': /* parent_id id time options user_priv del_pass ip name trip subject comment */
+			if (count != 12 || !f[11])
+				break;
+			for (i = 0; i < 5; i++)
+				if (number(f[i + 1], &n[i]))
+					return SQLITE_MISMATCH;
+			return db_transaction(db, SQL_STAGE_POST, board_id, n[0], n[1], n[2], n[3], n[4],
+			                      f[6], f[7], f[8], f[9], f[10], f[11], text_fingerprint(f[11]));
+	}
+	return SQLITE_MISMATCH;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 2)
+	{
+		fprintf(stderr, "usage: akari-restore [board] < board.dump\n");
+		return 1;
+	}
+	int err;
+	sqlite3 *db;
+	if ((err = db_open(&db, SQLITE_OPEN_READWRITE)))
+	{
+		fprintf(stderr, "akari-restore: cannot open database. (e%d: %s)\n", err, sqlite3_err[err]);
+		return 1;
+	}
+	char *buf = NULL, *f[DUMP_MAX_FIELDS];
+	char *board_id = NULL; /* set once the board record is restored */
+	size_t capacity;
+	long line = 0, rows = 0, posts = 0;
+	unsigned count;
+
+	/* header, then the board record, then threads and posts
+	 * committed every RESTORE_BATCH records, board statistics last
+	 * posts are staged and moved into place once per batch
+	 */
+	if (!read_record(&buf, &capacity) || dump_split(buf, f, DUMP_MAX_FIELDS) != 2
+	    || strcmp(f[0], "akari-dump") || atoi_s(f[1]) != DUMP_VER)
+	{
+		fprintf(stderr, "akari-restore: not an akari-dump version %d file.\n", DUMP_VER);
+		db_close(db);
+		return 1;
+	}
+	line++;
+	char pragma[64]; /* bulk loading runs better with a larger page cache */
+	sprintf(pragma, "PRAGMA cache_size=-%d;", RESTORE_CACHE_KIB);
+	if (!(err = sqlite3_exec(db, pragma, NULL, NULL, NULL)) && !(err = db_restore_stage(db)))
+		err = db_begin(db);
+	while (!err && read_record(&buf, &capacity))
+	{
+		line++;
+		count = dump_split(buf, f, DUMP_MAX_FIELDS);
+		if (!f[0] || strlen(f[0]) != 1 || count > DUMP_MAX_FIELDS)
+			err = SQLITE_MISMATCH;
+		else if (*f[0] == 'B') /* id name desc status post_seq */
+		{
+			long status, post_seq;
+			if (board_id || count != 6 || !f[1] || number(f[4], &status) || number(f[5], &post_seq))
+				err = SQLITE_MISMATCH;
+			else if ((err = db_transaction(db, SQL_RESTORE_BOARD, (argc > 1) ? argv[1] : f[1],
+			                               f[2], f[3], status, post_seq)))
+			{
+				if (err == SQLITE_CONSTRAINT)
+					fprintf(stderr, "akari-restore: /%s/ already exists.\n",
+					        (argc > 1) ? argv[1] : f[1]);
+			}
+			else
+				board_id = strdup((argc > 1) ? argv[1] : f[1]);
+		}
+		else if (!board_id)
+			err = SQLITE_MISMATCH;
+		else if (!(err = restore_record(db, board_id, f, count)))
+			posts += (*f[0] == 'P');
+		if (!err && ++rows % RESTORE_BATCH == 0
+		    && !(err = db_restore_flush(db)) && !(err = db_commit(db)))
+			err = db_begin(db);
+	}
+	if (!err && !board_id)
+		err = SQLITE_MISMATCH; /* empty dump */
+	if (!err && !(err = db_restore_flush(db)) && !(err = db_restore_stats(db, board_id)))
+		err = db_commit(db);
+
+	if (err)
+	{
+		db_rollback(db);
+		if (err == SQLITE_MISMATCH)
+			fprintf(stderr, "akari-restore: malformed record on line %ld.\n", line);
+		else if (err != SQLITE_CONSTRAINT || board_id)
+			fprintf(stderr, "akari-restore: %s on line %ld. (e%d: %s)\n",
+			        sqlite3_errmsg(db), line, err, sqlite3_err[err]);
+		if (board_id) /* remove batches already committed */
+		{
+			int purge = db_begin(db);
+			if (!purge && !(purge = db_board_purge(db, board_id)))
+				purge = db_commit(db);
+			if (purge)
+			{
+				db_rollback(db);
+				fprintf(stderr, "akari-restore: couldn't remove partially restored /%s/.\n", board_id);
+			}
+		}
+	}
+	else
+	{
+		/* comment markup, a board left unrendered still displays */
+		long cursor = 0, count = 0;
+		int render;
+		do
+		{
+			if (!(render = db_begin(db)) && !(render = markup_rebuild(db, board_id, &cursor, &count)))
+				render = db_commit(db);
+		} while (!render && count == RENDER_BATCH);
+		if (render)
+		{
+			db_rollback(db);
+			fprintf(stderr, "akari-restore: couldn't render /%s/, run akari-render. (e%d: %s)\n",
+			        board_id, render, sqlite3_err[render]);
+		}
+		fprintf(stderr, "akari-restore: /%s/ %ld records, %ld posts\n", board_id, rows, posts);
+	}
+	free(board_id);
+	free(buf);
+	db_close(db);
+	return !!err;
+}
@@ -2,12 +2,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <limits.h>
 #include <sqlite3.h>
 #include "global.h"
 #include "database.h"
 #include "query.h"
 #include "utf8.h"
-#include "substr.h"
+#include "markup.h"
 #include "macros.h"
 
 /*
@@ -18,11 +19,9 @@
 
 /*
 	todo:
-		rewrite enquote_comment to get correct thread and link
 		if requested ID is not found in the thread, search through /post/12345 and display that
 
 		push unique cookie to set up user authentication for moderators
-		search.cgi feature, search all and posts
 		push post numbers to user's localStorage so they can have (You)'s
 		push salted crypt(3) cookie to user to serve as deletion password
 		move cookie and tripcode routines to auth.c
@@ -37,6 +36,7 @@ enum op_mode {
 	THREAD_MODE,
 	ARCHIVE_MODE,
 	ARCHIVE_VIEWER,
+	CATALOG_MODE,
 	PEEK_MODE,
 	NOT_FOUND,
 	REDIRECT
@@ -50,6 +50,8 @@ struct parameters {
 	long page_no;
 	long active_threads; /* statistics */
 	long archived_threads;
+	long archive_expiry; /* archive keyset cursor */
+	long archive_post;
 };
 
 const char *const global_template[] = {
@@ -81,7 +83,6 @@ const char *const global_template[] = {
 	- html goes in separate templates.h / templates.c
 	- insert post number into localStorage to emulate (You) quotes
 	- add admin panel w/ login
-	- db_fetch_parent() to provide correct quotelinks in the future
 	- gzip compression (????)
  */
 
@@ -98,178 +99,18 @@ const char *const global_template[] = {
 		- /board/thread/12340 - thread mode
  */
 
-/* NOTES:
- * on higher optmization levels (-O2), GCC will introduce false positive
- * Valgrind errors which make it seem like the value of *str isn't being
- * updated immediately after realloc, allowing the function to peek
- * backwards into heap memory.
- * eg. "Invalid read of size 4"
- *     "Address 0xABCDEF is 72 bytes inside a block of size 73 alloc'd"
- * Program still exhibits expected behavior regardless of optimizations.
- */
-
-char *enquote_comment(char **loc, const long id)
-{
-	/* rewrite string with quote markup and
-	 * generate client-side javascript functionality
-	 * - function 'popup(self, request, hover)' requires post id
-	 */
-	const char *gt = escape('>'), *nl = escape('\n'); /* escape codes */
-	static const char *const quote[] = {
-		"<span class=\"quote\">", "</span>"
-	};
-	static const char *const linkquote[] = {
-		"<a class=\"linkquote\" href=\"#p%s\" "
-		"onMouseOver=\"popup('p%ld','p%s',1)\" "
-		"onMouseOut=\"popup('p%ld','p%s',0)\" "
-		"onClick=\"popup('p%ld','p%s',0)\">",
-		"</a>"
-	};
-	char *str = *loc;
-	if (!strstr(str, gt)) /* no '>' found */
-		return str;
-	unsigned i;
-	for (i = 0; str[i]; i++)
-	{
-		unsigned length = strlen(str);
-		char *seek = strstr(&str[i], gt); /* seek to next '>' or to end */
-		i = (!seek) ? length : (unsigned) (seek - str);
-		if (length < i + max(strlen(gt), strlen(nl))) /* bounds check */
-			break;
-		/* '>>' linkquote */
-		else if (!memcmp(&str[i + strlen(gt)], gt, strlen(gt)))
-		{
-			/* linkquote post number cannot begin with leading zero
-			 * and shouldn't be longer than 20 digits
-			 */
-			char c = str[i + (strlen(gt) * 2)]; /* peek ahead */
-			if (c >= '1' && c <= '9')
-			{
-				unsigned j = i + (strlen(gt) * 2);
-				unsigned k = 0;
-				const unsigned N_MAX = 20;
-				char num[N_MAX]; /* get post number */
-				char tag[300]; /* tag buffer */
-				while (str[j] >= '0' && str[j] <= '9' && k < N_MAX)
-					num[k++] = str[j++];
-				num[k] = '\0'; /* create tag */
-				sprintf(tag, linkquote[0], num, id, num, id, num, id, num);
-				unsigned offset_a = strlen(tag); /* part 1 */
-				str = (char *) realloc(str, strlen(str) + offset_a + 1);
-				memmove(&str[i+offset_a], &str[i], strlen(&str[i]) + 1);
-				memcpy(&str[i], tag, offset_a);
-				j += offset_a; /* new length adjustment */
-
-				/* index 'j' now points to the right of the post number */
-				unsigned offset_b = strlen(linkquote[1]); /* part 2 */
-				str = (char *) realloc(str, strlen(str) + offset_b + 1);
-				memmove(&str[j+offset_b], &str[j], strlen(&str[j]) + 1);
-				memcpy(&str[j], linkquote[1], offset_b);
-				i += offset_a + offset_b;
-			}
-			else
-				i += (strlen(gt) * 2);
-		}
-		/* '>' quote */
-		else if (&str[0] == &str[i] || /* conditional bounds checking */
-		!memcmp(&str[i - ((i < strlen(nl)) ? 0 : strlen(nl))], nl, strlen(nl)))
-		{
-			/* don't seek backwards if too close to the start of the array
-			 * '>' quotes are only valid at the start of a new line
-			 */
-			unsigned offset_a = strlen(quote[0]); /* part 1 */
-			str = (char *) realloc(str, strlen(str) + offset_a + 1);
-			memmove(&str[i+offset_a], &str[i], strlen(&str[i]) + 1);
-			memcpy(&str[i], quote[0], offset_a);
-
-			/* seek to the next newline or to end */
-			char *pos = strstr(&str[i], nl); /* part 2 */
-			unsigned j = (!pos) ? strlen(str) : (unsigned) (pos - str);
-			unsigned offset_b = strlen(quote[1]);
-			str = (char *) realloc(str, strlen(str) + offset_b + 1);
-			memmove(&str[j+offset_b], &str[j], strlen(&str[j]) + 1);
-			memcpy(&str[j], quote[1], offset_b);
-			i += offset_a + offset_b;
-		}
-	}
-	*loc = str;
-	return str;
-}
-
-char *format_comment(char **loc)
-{
-	/* replace matching [tags] with corresponding markup with exceptions:
-	 * 1. nesting:
-	 *     - nesting of [tags] is fine
-	 * 2. auto-complete:
-	 *     - implicit [/tag] added to end of string if none found
-	 * 3. [code] blocks:
-	 *     - nesting of other tags within code blocks is not allowed
-	 *     - must be processed last for this reason
-	 */
-	static const char *const markup[] = {
-		[SPOILER_L] = "<span class=\"spoiler\">", [SPOILER_R] = "</span>",
-		[CODE_L] = "<div class=\"codeblock\">", [CODE_R] = "</div>"
-	};
-	/* some assumptions about the format tag system */
-	static_assert(static_size(markup) == SUPPORTED_TAGS); /* size check */
-	static_assert((SUPPORTED_TAGS % 2) == 0); /* tag count must be even */
-	static_assert((SUPPORTED_TAGS - 2) == CODE_L); /* [code] must come last */
-
-	char *str = *loc;
-	struct substr *extract = substr_extract(str, fmt[CODE_L], fmt[CODE_R]);
-	unsigned i, j, k, l;
-	for (i = 0; i < SUPPORTED_TAGS; i += 2)
-	{
-		if (i == CODE_L) /* restore [code] tag regions */
-			substr_restore(extract, str);
-		for (j = 0; str[j]; j++)
-		{
-			char *from = strstr(&str[j], fmt[i]); /* left tag */
-			j = (!from) ? strlen(str) : (unsigned) (from - str);
-			if (!str[j])
-				break;
-			k = strstr(str, fmt[i+1]) - str;
-			if (j >= k) /* malformed tag order */
-				break;
-			l = strlen(fmt[i]); /* overlap */
-			memmove(&str[j], &str[j+l], strlen(&str[j+l]) + 1);
-			unsigned offset_a = strlen(markup[i]);
-			str = (char *) realloc(str, strlen(str) + offset_a + 1);
-			memmove(&str[j+offset_a], &str[j], strlen(&str[j]) + 1);
-			memcpy(&str[j], markup[i], offset_a);
-
-			char *to = strstr(&str[j], fmt[i+1]); /* right tag */
-			k = (!to) ? strlen(str) : (unsigned) (to - str);
-			l = strlen(fmt[i+1]); /* overlap */
-			if (to) /* overlap only if tag found */
-				memmove(&str[k], &str[k+l], strlen(&str[k+l]) + 1);
-			unsigned offset_b = strlen(markup[i+1]);
-			str = (char *) realloc(str, strlen(str) + offset_b + 1);
-			memmove(&str[k+offset_b], &str[k], strlen(&str[k]) + 1);
-			memcpy(&str[k], markup[i+1], offset_b);
-		}
-	}
-	*loc = str;
-	return str;
-}
-
 char *post_digest(sqlite3 *db, const char *board_id, const long id, unsigned len)
 {
 	/* returns post preview up to len characters */
-	static const char *sql =
-		"SELECT * FROM posts WHERE board_id = \"%s\" AND id = %ld;";
-	char *cmd = sql_generate(sql, board_id, id);
 	char *dest = NULL;
 	struct resource res;
-	if (db_resource_fetch(db, &res, cmd))
+	if (db_resource_fetch(db, &res, 1, SQL_FETCH_POST, board_id, id))
 	{
 		struct post *p = &res.arr[0];
 		char *src = (!p->subject) ? p->comment : p->subject;
-		dest = utf8_truncate(src, len);
+		dest = xss_truncate(src, len);
 	}
 	db_resource_free(&res);
-	free(cmd);
 	return dest;
 }
 
@@ -283,6 +124,7 @@ char *generate_pagetitle(sqlite3 *db, struct parameters *params, struct board *l
 		[INDEX_MODE] = "/%s/ - %s - Page %ld - %s",
 		[THREAD_MODE] =	"/%s/ - %s - %s - %s",
 		[ARCHIVE_VIEWER] = "/%s/ - Archive - %s",
+		[CATALOG_MODE] = "/%s/ - Catalog - %s",
 		[PEEK_MODE] =	"Post No.%ld on /%s/",
 		[NOT_FOUND] = "%s - 404 Not Found",
 		[REDIRECT] = "%s - 301 Moved Permanently"
@@ -309,6 +151,7 @@ char *generate_pagetitle(sqlite3 *db, struct parameters *params, struct board *l
 				        list->arr[i].name, IDENT_FULL);
 				free(digest); break;
 		case ARCHIVE_VIEWER:
+		case CATALOG_MODE:
 				sprintf(buf, pat[params->mode], params->board_id, IDENT_FULL); break;
 		case PEEK_MODE:
 				sprintf(buf, pat[params->mode], params->thread_id, params->board_id); break;
@@ -468,7 +311,9 @@ void display_navigation(const struct parameters *params, int bottom)
 			"[<a href=\"%s?board=%s&page=%u\">%u</a>] ",
 			"Page %u of %u",
 		/* misc buttons */
+			"[<a href=\"%s?board=%s&catalog=1\">Catalog</a>] ",
 			"[<a href=\"%s?board=%s&archive=1\">Archive</a>] ",
+			"[<a href=\"%s?board=%s\">Search</a>] ",
 		"</span>"
 	};
 	/* functionally identical */
@@ -476,10 +321,12 @@ void display_navigation(const struct parameters *params, int bottom)
 	unsigned i;
 	for (i = 0; i < 2; i++)
 		fprintf(stdout, navi[i]);
-	if (mode == THREAD_MODE || mode == ARCHIVE_VIEWER) /* return */
+	if (mode == THREAD_MODE || mode == ARCHIVE_VIEWER || mode == CATALOG_MODE) /* return */
 		fprintf(stdout, navi[4], BOARD_SCRIPT, params->board_id);
 	fprintf(stdout, (!bottom) ? navi[2] : navi[3]); /* top / bottom */
 	fprintf(stdout, navi[13], BOARD_SCRIPT, params->board_id); /* catalog */
+	fprintf(stdout, navi[14], BOARD_SCRIPT, params->board_id); /* archive */
+	fprintf(stdout, navi[15], SEARCH_SCRIPT, params->board_id);
 	unsigned pages = params->active_threads / THREADS_PER_PAGE;
 	if (params->active_threads % THREADS_PER_PAGE)
 		pages++; /* ceiling */
@@ -508,10 +355,10 @@ void display_navigation(const struct parameters *params, int bottom)
 	}
 	else if (mode == THREAD_MODE) /* thread info */
 		fprintf(stdout, navi[5], params->thread_id);
-	fprintf(stdout, "%s%s", navi[14], navi[0]);
+	fprintf(stdout, "%s%s", navi[16], navi[0]);
 }
 
-void display_statistics(struct parameters *params, long replies, long thread_id)
+void display_statistics(struct parameters *params, const struct thread_stats *ts, long thread_id)
 {
 	/* display thread statistics
 	 * INDEX_MODE requires explicit thread id for URL links
@@ -523,6 +370,7 @@ void display_statistics(struct parameters *params, long replies, long thread_id)
 			"%s %ld repl%s. ",
 			"%s %ld repl%s, %ld post%s omitted. ",
 			"[<a href=\"%s?board=%s&thread=%ld\">Click here</a>] to view.",
+			"%ld poster%s. ",
 		"</div>"
 	};
 	int mode = params->mode;
@@ -531,8 +379,10 @@ void display_statistics(struct parameters *params, long replies, long thread_id)
 		case ARCHIVE_MODE:
 		case PEEK_MODE: mode = THREAD_MODE;
 	}
+	const long replies = ts->replies;
 	const char *p1 = (replies == 1) ? "y" : "ies"; /* plurals */
 	const char *p2 = (replies == 1) ? "" : "s";
+	const char *p3 = (ts->posters == 1) ? "" : "s";
 	fprintf(stdout, ins[0]);
 	if (!replies)
 		fprintf(stdout, ins[2], ins[1], p1);
@@ -545,26 +395,89 @@ void display_statistics(struct parameters *params, long replies, long thread_id)
 			fprintf(stdout, ins[3], ins[1], replies, p1);
 		else
 			fprintf(stdout, ins[4], ins[1], replies, p1, omitted, p2);
+		fprintf(stdout, ins[6], ts->posters, p3);
 		fprintf(stdout, ins[5], BOARD_SCRIPT, params->board_id, thread_id);
 	}
 	else if (mode == THREAD_MODE)
 	{
-		if (!replies)
-			fprintf(stdout, ins[2], ins[1], p1);
-		else
-			fprintf(stdout, ins[3], ins[1], replies, p1);
+		fprintf(stdout, ins[3], ins[1], replies, p1);
+		fprintf(stdout, ins[6], ts->posters, p3);
 	}
-	if (replies > THREAD_BUMP_LIMIT)
+	if (ts->bump_limit)
 		fprintf(stdout, " <i>Bump limit reached.</i>");
-	fprintf(stdout, ins[6]);
+	fprintf(stdout, ins[7]);
+}
+
+void render_stale(sqlite3 *db, struct resource *res, int offset)
+{
+	/* render posts that predate MARKUP_VER, see akari-render
+	 * linkquotes of all of them are resolved together
+	 * stale posts without linkquotes are rendered all the same
+	 */
+	struct quotelist ql = { 0 };
+	unsigned i;
+	for (i = offset; i < res->count; i++)
+		if (!res->arr[i].rendered)
+			markup_quotes(&ql, res->arr[i].comment, res->arr[i].board_id);
+	if (ql.count)
+		markup_resolve(db, &ql); /* unresolved linkquotes are struck out */
+	for (i = offset; i < res->count; i++)
+		if (!res->arr[i].rendered)
+			res->arr[i].rendered = markup_render(res->arr[i].comment, res->arr[i].board_id,
+			                                     res->arr[i].parent_id, &ql);
+	markup_quotes_free(&ql);
+}
+
+void display_backlinks(const struct backlinks *bl, const struct post *p)
+{
+	/* posts quoting this one, oldest first
+	 * backlinks are ordered by quoted post, found by binary search
+	 */
+	static const char *const backlink[] = {
+		"<div class=\"pBacklinks\">",
+		/* same thread */
+		"<a class=\"linkquote\" href=\"#p%ld\" "
+		"onMouseOver=\"popup(this,'p%ld',1)\" "
+		"onMouseOut=\"popup(this,'p%ld',0)\" "
+		"onClick=\"popup(this,'p%ld',0)\">&gt;&gt;%ld</a> ",
+		/* another thread, previewed if it's on the same page */
+		"<a class=\"linkquote\" href=\"%s?board=%s&thread=%ld#p%ld\" "
+		"onMouseOver=\"popup(this,'p%ld',1)\" "
+		"onMouseOut=\"popup(this,'p%ld',0)\">&gt;&gt;%ld</a> ",
+		"</div>"
+	};
+	unsigned lo = 0, hi = (!bl) ? 0 : bl->count;
+	while (lo < hi)
+	{
+		unsigned mid = lo + (hi - lo) / 2;
+		if (bl->arr[mid].post_id < p->id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (!bl || lo == bl->count || bl->arr[lo].post_id != p->id)
+		return;
+	fprintf(stdout, backlink[0]);
+	for (; lo < bl->count && bl->arr[lo].post_id == p->id; lo++)
+	{
+		const long from = bl->arr[lo].from_id;
+		if (bl->arr[lo].from_parent == p->parent_id)
+			fprintf(stdout, backlink[1], from, from, from, from, from);
+		else
+			fprintf(stdout, backlink[2], BOARD_SCRIPT, p->board_id, bl->arr[lo].from_parent,
+			        from, from, from, from);
+	}
+	fprintf(stdout, backlink[3]);
 }
 
-void display_resource(struct resource *res, int mode, int offset)
+void display_resource(sqlite3 *db, struct resource *res, const struct backlinks *bl, int mode, int offset)
 {
 	/* print all post data stored in post container
 	 * starting from given offset value
+	 * backlinks are optional
 	 */
 	unsigned i;
+	render_stale(db, res, offset);
 	for (i = offset; i < res->count; i++)
 	{
 		/* use default name if not provided */
@@ -572,8 +485,7 @@ void display_resource(struct resource *res, int mode, int offset)
 		const long id = res->arr[i].id; /* post id */
 		const long parent_id = res->arr[i].parent_id; /* parent id */
 		unsigned is_parent = (id == parent_id); /* OP post */
-		enquote_comment(&res->arr[i].comment, id); /* reformat comment string */
-		const char *comment = format_comment(&res->arr[i].comment);
+		const char *comment = (!res->arr[i].rendered) ? "" : res->arr[i].rendered;
 		const char *op = (is_parent) ? " parent" : ""; /* opening post */
 		const char *sage = (res->arr[i].options & POST_SAGE) ? " sage" : ""; /* sage */
 
@@ -597,6 +509,7 @@ void display_resource(struct resource *res, int mode, int offset)
 			                "[<a href=\"%s?board=%s&thread=%ld\">Reply</a>]</span>",
 		                     BOARD_SCRIPT, res->arr[i].board_id, res->arr[i].parent_id);
 		fprintf(stdout, "</span>");
+		display_backlinks(bl, &res->arr[i]);
 		fprintf(stdout, "<div class=\"pComment\">%s</div>", comment);
 		fprintf(stdout, "</div>%s", (!is_parent) ? "</div>" : ""); /* end wrapper */
 	}
@@ -668,50 +581,56 @@ void index_mode(sqlite3 *db, struct board *list, struct parameters *params)
 {
 	/* compute index ranking
 	 * display thread previews from selected page
+	 * page is loaded with two queries regardless of thread length
 	 */
 	display_headers(list, params->board_id);
 	display_boardlist(list, NULL);
 	display_postform(params->mode, params->board_id, 0);
 	display_navigation(params, 0);
-	static const char *const sql[] = {
-		"SELECT post_id FROM active_threads WHERE "
-			"board_id = \"%s\" ORDER BY last_bump DESC;",
-		"SELECT * FROM posts WHERE "
-			"board_id = \"%s\" AND parent_id = %ld ORDER BY id ASC;"
-	};
 	long thread_count = params->active_threads;
-	char *rank = sql_generate(sql[0], params->board_id);
-	long *index = db_array_retrieval(db, rank, thread_count);
 	long offset = params->page_no * THREADS_PER_PAGE;
-	long limit = min(offset + THREADS_PER_PAGE, thread_count);
 	if (!thread_count)
 		fprintf(stdout, "<h2>There aren't any threads yet.</h2>");
 	else if (offset > thread_count) /* sanity check */
 		fprintf(stdout, "<h2>There aren't that many threads here.</h2>");
 	else
 	{
-		unsigned i;
-		for (i = offset; i < limit; i++)
+		long thread[THREADS_PER_PAGE];
+		struct thread_stats stats[THREADS_PER_PAGE];
+		unsigned i, j, count = 0; /* thread ranking and statistics */
+		sqlite3_stmt *stmt = db_statement(db, SQL_INDEX_THREADS, params->board_id,
+		                                  (long) THREADS_PER_PAGE, offset);
+		while (stmt && count < THREADS_PER_PAGE && sqlite3_step(stmt) == SQLITE_ROW)
 		{
-			if (i != offset)
+			thread[count] = sqlite3_column_int64(stmt, 0);
+			stats[count].replies = sqlite3_column_int64(stmt, 1);
+			stats[count].last_post = sqlite3_column_int64(stmt, 2);
+			stats[count].posters = sqlite3_column_int64(stmt, 3);
+			stats[count++].bump_limit = sqlite3_column_int(stmt, 4);
+		}
+		sqlite3_reset(stmt);
+		struct resource res; /* OP and reply previews of every thread */
+		db_resource_fetch(db, &res, count * (MAX_REPLY_PREVIEW + 1), SQL_INDEX_POSTS,
+		                  params->board_id, (long) THREADS_PER_PAGE, offset, (long) MAX_REPLY_PREVIEW);
+		for (i = 0; i < count; i++)
+		{
+			/* posts arrive grouped by thread in ranking order */
+			for (j = 0; j < res.count && res.arr[j].parent_id != thread[i]; j++);
+			if (j == res.count || res.arr[j].id != thread[i]) /* bumped or pruned meanwhile */
+				continue;
+			struct resource preview = { 0, &res.arr[j] };
+			while (j < res.count && res.arr[j++].parent_id == thread[i])
+				preview.count++;
+			if (i)
 				fprintf(stdout, "<div class=\"line\"></div>");
-			struct resource res; /* fetch thread */
-			char *current = sql_generate(sql[1], params->board_id, index[i]);
-			long replies = db_resource_fetch(db, &res, current) - 1;
-			long omitted = 0;
-			if (replies > MAX_REPLY_PREVIEW)
-				omitted = replies - MAX_REPLY_PREVIEW;
-			struct resource parent = { 1 , res.arr }; /* OP */
-			display_resource(&parent, params->mode, 0);
-			display_statistics(params, replies, index[i]);
-			display_resource(&res, params->mode, omitted + 1); /* replies */
-			db_resource_free(&res);
-			free(current);
+			struct resource parent = { 1, preview.arr }; /* OP */
+			display_resource(db, &parent, NULL, params->mode, 0);
+			display_statistics(params, &stats[i], thread[i]);
+			display_resource(db, &preview, NULL, params->mode, 1); /* replies */
 		}
+		db_resource_free(&res);
 	}
 	display_navigation(params, 1);
-	free((!index) ? NULL : index);
-	free(rank);
 }
 
 void thread_mode(sqlite3 *db, struct board *list, struct parameters *params)
@@ -723,26 +642,26 @@ void thread_mode(sqlite3 *db, struct board *list, struct parameters *params)
 	display_boardlist(list, NULL);
 	display_postform(params->mode, params->board_id, params->thread_id);
 	display_navigation(params, 0);
-	static const char *sql =
-		"SELECT * FROM posts WHERE "
-			"board_id = \"%s\" AND parent_id = %ld ORDER BY id ASC;";
+	struct thread_stats stats;
+	db_thread_stats(db, params->board_id, params->thread_id, &stats);
 	struct resource res; /* fetch thread */
-	char *cmd = sql_generate(sql, params->board_id, params->thread_id);
-	int replies = db_resource_fetch(db, &res, cmd) - 1;
+	db_resource_fetch(db, &res, stats.replies + 1, SQL_THREAD, params->board_id, params->thread_id);
+	struct backlinks bl;
+	db_backlink_fetch(db, &bl, SQL_THREAD_BACKLINKS, params->board_id, params->thread_id);
 	struct resource parent = { 1, res.arr }; /* OP */
-	display_resource(&parent, params->mode, 0);
-	display_statistics(params, replies, 0);
-	display_resource(&res, params->mode, 1); /* replies */
+	display_resource(db, &parent, &bl, params->mode, 0);
+	display_statistics(params, &stats, 0);
+	display_resource(db, &res, &bl, params->mode, 1); /* replies */
 	display_navigation(params, 1);
+	db_backlink_free(&bl);
 	db_resource_free(&res);
-	free(cmd);
 }
 
 void archive_viewer(sqlite3 *db, struct board *list, struct parameters *params)
 {
 	/* specialized reimplementation of display_resource()
-	 * display table of archived threads
-	 * reformat fields as needed
+	 * display table of archived threads from summaries kept at archive time
+	 * one page per request, continuing after the keyset cursor
 	 */
 	static const char *const column[] = {
 		"No.", "Name", "Digest", "Replies", "Expires", "Link"
@@ -765,28 +684,22 @@ void archive_viewer(sqlite3 *db, struct board *list, struct parameters *params)
 				"[<a href=\"%s?board=%s&thread=%ld\">View</a>]"
 			"</center></td>"
 		"</tr>",
-		"</table>"
-	};
-	static const char *sql[] = {
-		"SELECT post_id FROM archived_threads WHERE "
-			"board_id = \"%s\" ORDER BY expiry DESC;",
-		"SELECT * FROM posts WHERE board_id = \"%s\" "
-			"AND parent_id = %ld ORDER by id ASC;",
-		"SELECT expiry from archived_threads WHERE "
-			"board_id = \"%s\" AND post_id = %ld;"
+		"</table>",
+		/* pagination */
+		"<div class=\"navi controls center\">",
+			"[<a href=\"%s?board=%s&archive=1\">Newest</a>] ",
+			"[<a href=\"%s?board=%s&archive=1&expiry=%ld&post=%ld\">Older</a>]",
+		"</div>"
 	};
 	display_headers(list, params->board_id);
 	display_boardlist(list, NULL);
 	display_postform(params->mode, params->board_id, params->archived_threads);
 	display_navigation(params, 0);
-	long archived_count = params->archived_threads;
-	char *archive = sql_generate(sql[0], params->board_id);
-	long *index = db_array_retrieval(db, archive, archived_count);
-	if (!archived_count)
+	if (!params->archived_threads)
 		fprintf(stdout, "<h2>No threads have been pruned yet.</h2>");
 	else
 	{
-		unsigned i, j, sel = 0;
+		unsigned i, j, sel = 0, count = 0;
 		for (i = 0; i < 3; i++) /* heading */
 		{
 			if (i == 1)
@@ -795,67 +708,122 @@ void archive_viewer(sqlite3 *db, struct board *list, struct parameters *params)
 			else
 				fprintf(stdout, table[i]);
 		}
-		for (i = 0; i < archived_count; i++)
+		/* one row past the page tells if there is an older page */
+		long expiry = params->archive_expiry, post_id = params->archive_post;
+		sqlite3_stmt *stmt = db_statement(db, SQL_ARCHIVE_PAGE, params->board_id,
+		                                  expiry, post_id, (long) ARCHIVE_PER_PAGE + 1);
+		while (stmt && sqlite3_step(stmt) == SQLITE_ROW && count++ < ARCHIVE_PER_PAGE)
 		{
-			struct resource res; /* fetch thread */
-			char *current = sql_generate(sql[1], params->board_id, index[i]);
-			long replies = db_resource_fetch(db, &res, current) - 1;
-			free(current);
-			struct post *p = &res.arr[0]; /* reformat info */
+			post_id = sqlite3_column_int64(stmt, 0);
+			expiry = sqlite3_column_int64(stmt, 1);
+			long replies = sqlite3_column_int64(stmt, 2);
+			const char *name = (const char *) sqlite3_column_text(stmt, 3);
+			const char *trip = (const char *) sqlite3_column_text(stmt, 4);
+			const char *text = (const char *) sqlite3_column_text(stmt, 5);
+			char *subj = (!text) ? NULL : xss_truncate(text, ARCHIVE_SUBJECT);
+			text = (const char *) sqlite3_column_text(stmt, 6);
+			char *comm = (!text) ? NULL : xss_truncate(text, ARCHIVE_DIGEST);
 			static const char *pat_a = " <span class=\"pTrip\">%s</span>";
-			char *name = (!p->name) ? DEFAULT_NAME : p->name;
-			char *trip = (!p->trip) ? NULL : sql_generate(pat_a, p->trip);
-			char *subj = (!p->subject) ? NULL : utf8_truncate(p->subject, 30);
-			char *comm = utf8_truncate(p->comment, 40);
+			char *tripcode = (!trip) ? NULL : sql_generate(pat_a, trip);
 			static const char *pat_b = "<span class=\"pSubject\">%s:</span> %s";
-			char *digest = (!subj) ? strdup(comm) : sql_generate(pat_b, subj, comm);
-			free(subj); free(comm);
+			char *digest = (!subj) ? NULL : sql_generate(pat_b, subj, (!comm) ? "" : comm);
 
-			/* get expire time */
-			char *expire = sql_generate(sql[2], params->board_id, index[i]);
-			time_t expire_time = db_retrieval(db, expire);
-			free(expire);
 			char time_str[100]; /* human readable date */
+			time_t expire_time = expiry;
 			struct tm *ts = localtime(&expire_time);
 			strftime(time_str, 100, "%a, %m/%d/%y %I:%M:%S %p", ts);
 
-			fprintf(stdout, table[3], color[sel], p->parent_id, name, (!trip) ? "" : trip,
-			        digest, replies, time_str, BOARD_SCRIPT, p->board_id, p->parent_id);
-			free(trip); free(digest);
-			db_resource_free(&res);
+			fprintf(stdout, table[3], color[sel], post_id, (!name) ? DEFAULT_NAME : name,
+			        (!tripcode) ? "" : tripcode, (digest) ? digest : (!comm) ? "" : comm,
+			        replies, time_str, BOARD_SCRIPT, params->board_id, post_id);
+			free(tripcode); free(digest); free(subj); free(comm);
 			sel = !sel;
 		}
+		sqlite3_reset(stmt);
 		fprintf(stdout, table[4]);
+		if (!count)
+			fprintf(stdout, "<h2>There aren't any older threads.</h2>");
+		fprintf(stdout, table[5]);
+		fprintf(stdout, table[6], BOARD_SCRIPT, params->board_id);
+		if (count > ARCHIVE_PER_PAGE) /* continue after last row shown */
+			fprintf(stdout, table[7], BOARD_SCRIPT, params->board_id, expiry, post_id);
+		fprintf(stdout, table[8]);
+	}
+	display_navigation(params, 1);
+}
+
+void catalog_mode(sqlite3 *db, struct board *list, struct parameters *params)
+{
+	/* display every active thread as a compact grid of OP digests
+	 * in index ranking order, served by a single query
+	 */
+	static const char *const grid[] = {
+		"<div class=\"catalog center\">",
+		/* thread */
+			"<div class=\"cThread\">"
+				"<div class=\"navi controls\">"
+					"[<a href=\"%s?board=%s&thread=%ld\">No.%ld</a>]"
+				"</div>"
+				"<div class=\"cStats\">R: <b>%ld</b>%s / %s</div>",
+				"<span class=\"pSubject\">%s:</span> ",
+				"<span class=\"cComment\">%s</span>"
+			"</div>",
+		"</div>"
+	};
+	display_headers(list, params->board_id);
+	display_boardlist(list, NULL);
+	display_postform(INDEX_MODE, params->board_id, 0);
+	display_navigation(params, 0);
+	if (!params->active_threads)
+		fprintf(stdout, "<h2>There aren't any threads yet.</h2>");
+	else
+	{
+		fprintf(stdout, grid[0]);
+		sqlite3_stmt *stmt = db_statement(db, SQL_CATALOG, params->board_id,
+		                                  (long) MAX_ACTIVE_THREADS, (long) CATALOG_DIGEST * ESCAPE_MAX);
+		while (stmt && sqlite3_step(stmt) == SQLITE_ROW)
+		{
+			long post_id = sqlite3_column_int64(stmt, 0);
+			time_t last_bump = sqlite3_column_int64(stmt, 1);
+			long replies = sqlite3_column_int64(stmt, 2);
+			int bump_limit = sqlite3_column_int(stmt, 3);
+			const char *subj = (const char *) sqlite3_column_text(stmt, 4);
+			char *comm = xss_truncate((const char *) sqlite3_column_text(stmt, 5), CATALOG_DIGEST);
+
+			char time_str[100]; /* human readable date */
+			strftime(time_str, 100, "%m/%d/%y %I:%M %p", localtime(&last_bump));
+			fprintf(stdout, grid[1], BOARD_SCRIPT, params->board_id, post_id, post_id,
+			        replies, (bump_limit) ? " <i>(bump limit)</i>" : "", time_str);
+			if (subj)
+				fprintf(stdout, grid[2], subj);
+			fprintf(stdout, grid[3], comm);
+			free(comm);
+		}
+		sqlite3_reset(stmt);
+		fprintf(stdout, grid[4]);
 	}
-	free(archive);
-	free((!index) ? NULL : index);
 	display_navigation(params, 1);
 }
 
 void peek_mode(sqlite3 *db, struct parameters *params)
 {
 	/* preview a single post
-	 * display reply count if parent post
+	 * display thread statistics if parent post
 	 */
-	static const char *sql =
-		"SELECT * FROM posts WHERE board_id = \"%s\" AND parent_id = %ld;";
 	struct resource res;
-	char *cmd = sql_generate(sql, params->board_id, params->parent_id);
-	long total_posts = db_resource_fetch(db, &res, cmd);
-	unsigned i;
-	for (i = 0; i < total_posts; i++)
+	if (db_resource_fetch(db, &res, 1, SQL_FETCH_POST, params->board_id, params->thread_id))
 	{
-		if (res.arr[i].id == params->thread_id)
-		{
-			struct resource post = { 1, &res.arr[i] };
-			display_resource(&post, params->mode, 0);
-			if (res.arr[i].id == res.arr[i].parent_id) /* OP */
-				display_statistics(params, total_posts - 1, 0);
-			break;
-		}
+		struct backlinks bl;
+		db_backlink_fetch(db, &bl, SQL_POST_BACKLINKS, params->board_id,
+		                  res.arr[0].parent_id, res.arr[0].id);
+		display_resource(db, &res, &bl, params->mode, 0);
+		db_backlink_free(&bl);
+		struct thread_stats stats;
+		if (res.arr[0].id == res.arr[0].parent_id /* OP */
+		    && db_thread_stats(db, params->board_id, params->parent_id, &stats))
+			display_statistics(params, &stats, 0);
 	}
 	db_resource_free(&res);
-	free(cmd);
 }
 
 struct parameters get_params(sqlite3 *db, const char *query, struct board *list)
@@ -873,6 +841,9 @@ struct parameters get_params(sqlite3 *db, const char *query, struct board *list)
 		           *thread = query_search(&query, "thread"),
 		           *page = query_search(&query, "page"),
 		           *archive = query_search(&query, "archive"),
+		           *catalog = query_search(&query, "catalog"),
+		           *expiry = query_search(&query, "expiry"),
+		           *post = query_search(&query, "post"),
 		           *peek = query_search(&query, "peek");
 		if (board)
 		{
@@ -885,17 +856,8 @@ struct parameters get_params(sqlite3 *db, const char *query, struct board *list)
 		else
 		{
 			/* get general board statistics */
-			static const char *const sql[] = {
-				"SELECT COUNT(*) FROM active_threads WHERE board_id = \"%s\";",
-				"SELECT COUNT(*) FROM archived_threads WHERE board_id = \"%s\";"
-			};
-			char *cmd[2] = { 0 };
-			for (i = 0; i < 2; i++)
-				cmd[i] = sql_generate(sql[i], params.board_id);
-			params.active_threads = db_retrieval(db, cmd[0]);
-			params.archived_threads = db_retrieval(db, cmd[1]);
-			for (i = 0; i < 2; i++)
-				free(cmd[i]);
+			params.active_threads = db_retrieval(db, SQL_ACTIVE_COUNT, params.board_id);
+			params.archived_threads = db_retrieval(db, SQL_ARCHIVED_COUNT, params.board_id);
 
 			params.thread_id = atoi_s(thread);
 			if (params.thread_id > 0)
@@ -913,7 +875,18 @@ struct parameters get_params(sqlite3 *db, const char *query, struct board *list)
 					params.mode = THREAD_MODE;
 			}
 			else if (atoi_s(archive))
+			{
 				params.mode = ARCHIVE_VIEWER;
+				params.archive_expiry = LONG_MAX; /* newest first */
+				params.archive_post = LONG_MAX;
+				if (atoi_s(expiry) > 0 && atoi_s(post) > 0)
+				{
+					params.archive_expiry = atoi_s(expiry);
+					params.archive_post = atoi_s(post);
+				}
+			}
+			else if (atoi_s(catalog))
+				params.mode = CATALOG_MODE;
 			else
 			{
 				params.mode = INDEX_MODE;
@@ -932,34 +905,32 @@ struct parameters get_params(sqlite3 *db, const char *query, struct board *list)
 	return params;
 }
 
-int main(void)
+int fetch_boards(sqlite3 *db, struct board *list)
+{
+	/* fetch list of valid boards
+	 * prints plaintext error and returns non-zero on failure
+	 */
+	if (db_board_fetch(db, list))
+		return 0;
+	int err = sqlite3_errcode(db);
+	if (err == SQLITE_ERROR)
+		fprintf(stdout, "Nothing to do. Please add at least 1 board.");
+	else if (err == SQLITE_BUSY)
+		fprintf(stdout, "Server overloaded.\n"
+		                "Couldn't fetch boards within %dms.", BUSY_TIMEOUT_MS);
+	else /* generic error */
+		fprintf(stdout, "%s. %s.", sqlite3_errstr(err), sqlite3_errmsg(db));
+	fprintf(stdout, " (e%d: %s)\n", err, sqlite3_err[err]);
+	return 1;
+}
+
+void board_request(sqlite3 *db, struct board *list)
 {
+	/* serve a single request
+	 * all per-request state lives on this stack frame
+	 */
 	clock_t start = clock();
-	srand(time(NULL));
-	int err;
-	sqlite3 *db;
-	if ((err = sqlite3_open_v2(DATABASE_LOC, &db, 1, NULL))) /* read-only mode */
-	{
-		fprintf(stdout, "Cannot open database. (e%d: %s)", err, sqlite3_err[err]);
-		return 1;
-	}
-	struct board list = { 0 }; /* fetch list of valid boards */
-	unsigned retries = 0;
-	while (!db_board_fetch(db, &list) && retries++ < FETCH_MAX_RETRIES)
-		err = sqlite3_extended_errcode(db);
-	if (!list.count)
-	{
-		if (err == SQLITE_ERROR)
-			fprintf(stdout, "Nothing to do. Please add at least 1 board.");
-		else if (err == SQLITE_BUSY)
-			fprintf(stdout, "Server overloaded.\n"
-			                "Couldn't fetch boards after %d attempts.", FETCH_MAX_RETRIES);
-		else /* generic error */
-			fprintf(stdout, "%s. %s.", sqlite3_errstr(err), sqlite3_errmsg(db));
-		fprintf(stdout, " (e%d: %s)\n", err, sqlite3_err[err]);
-		return 1;
-	}
-	struct parameters params = get_params(db, getenv_s("QUERY_STRING"), &list);
+	struct parameters params = get_params(db, getenv_s("QUERY_STRING"), list);
 
 	/* HTTP response */
 	static const char *const response[] = {
@@ -971,14 +942,15 @@ int main(void)
 		    (!response[params.mode]) ? "200 OK" : response[params.mode]);
 
 	if (params.mode != PEEK_MODE) /* headers */
-		fprintf(stdout, global_template[0], generate_pagetitle(db, &params, &list));
+		fprintf(stdout, global_template[0], generate_pagetitle(db, &params, list));
 	switch (params.mode)
 	{
-		case HOMEPAGE: homepage_mode(&list); break;
-		case INDEX_MODE: index_mode(db, &list, &params); break;
+		case HOMEPAGE: homepage_mode(list); break;
+		case INDEX_MODE: index_mode(db, list, &params); break;
 		case THREAD_MODE:
-		case ARCHIVE_MODE: thread_mode(db, &list, &params); break;
-		case ARCHIVE_VIEWER: archive_viewer(db, &list, &params); break;
+		case ARCHIVE_MODE: thread_mode(db, list, &params); break;
+		case ARCHIVE_VIEWER: archive_viewer(db, list, &params); break;
+		case CATALOG_MODE: catalog_mode(db, list, &params); break;
 		case PEEK_MODE: peek_mode(db, &params); goto abort;
 		case NOT_FOUND: not_found(getenv_s("HTTP_REFERER")); goto abort;
 		case REDIRECT:
@@ -992,7 +964,7 @@ int main(void)
 	fprintf(stdout, "<br/><br/>");
 	char *modes[] = {
 		"Homepage", "Index Mode", "Thread Mode", "Archive Mode",
-		"Archive Viewer", "Peek Mode", "404 Not Found", "Redirect"
+		"Archive Viewer", "Catalog Mode", "Peek Mode", "404 Not Found", "Redirect"
 	};
 	fprintf(stdout, "[debug] mode: %s board: %s thread: %ld page: %ld<br/>active/archived: %ld/%ld get string: \"%s\"",
 		modes[params.mode], params.board_id, params.thread_id, params.page_no, params.active_threads,
@@ -1009,7 +981,30 @@ int main(void)
 	fprintf(stdout, global_template[1], IDENT, REVISION, DB_VER, (!delta) ? "" : pageload);
 
 	abort: fflush(stdout);
+}
+
+int main(void)
+{
+	/* database handle and board list persist across requests
+	 * when built for FastCGI, see request_loop()
+	 */
+	srand(time(NULL));
+	int err;
+	sqlite3 *db;
+	if ((err = db_open(&db, SQLITE_OPEN_READONLY)))
+	{
+		fprintf(stdout, "Cannot open database. (e%d: %s)", err, sqlite3_err[err]);
+		return 1;
+	}
+	struct board list = { 0 };
+	unsigned served;
+	request_loop(served)
+	{
+		if (list.count || !(err = fetch_boards(db, &list))) /* on failure, retry next request */
+			board_request(db, &list);
+		db_lock_report("board");
+	}
 	db_board_free(&list);
-	sqlite3_close(db);
-	return 0;
+	db_close(db);
+	return err;
 }
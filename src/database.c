@@ -1,3 +1,4 @@
+#define _POSIX_C_SOURCE 200112L /* nanosleep */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -75,68 +76,526 @@ char *sql_generate(const char *fmt, ...)
 	return out;
 }
 
-static char *sql_rowcount(const char *str)
+/* prepared statement registry */
+#define POST_COLUMNS \
+	"board_id, parent_id, id, time, options, user_priv, " \
+	"del_pass, ip, name, trip, subject, comment, rendered, markup_ver"
+static const struct {
+	const char *bind; /* parameter types */
+	const char *sql;
+} registry[] = {
+	/* validation */
+	[SQL_BOARD_STATUS] = { "s",
+		"SELECT status FROM boards WHERE id = ?1;" },
+	[SQL_THREAD_STATUS] = { "sl",
+		"SELECT status FROM active_threads "
+			"WHERE board_id = ?1 AND post_id = ?2;" },
+	[SQL_FIND_PARENT] = { "sl",
+		"SELECT parent_id FROM posts "
+			"WHERE board_id = ?1 AND id = ?2;" },
+	[SQL_ACTIVE_STATUS] = { "sl",
+		"SELECT COUNT(*) FROM active_threads "
+			"WHERE board_id = ?1 AND post_id = ?2;" },
+	[SQL_ARCHIVE_STATUS] = { "sl",
+		"SELECT COUNT(*) FROM archived_threads "
+			"WHERE board_id = ?1 AND post_id = ?2;" },
+	[SQL_BOARD_POSTS] = { "s",
+		"SELECT post_seq FROM boards WHERE id = ?1;" },
+	[SQL_THREAD_POSTS] = { "sl",
+		"SELECT replies + 1 FROM thread_stats "
+			"WHERE board_id = ?1 AND post_id = ?2;" },
+	[SQL_THREAD_STATS] = { "sl",
+		"SELECT replies, last_post, posters, bump_limit FROM thread_stats "
+			"WHERE board_id = ?1 AND post_id = ?2;" },
+	/* flood control */
+	[SQL_USER_THREADS] = { "ss",
+		"SELECT COUNT(*) FROM active_threads WHERE board_id = ?1 AND ip = ?2;" },
+	[SQL_DUPLICATE_POST] = { "lsl",
+		"SELECT MAX(time) FROM posts "
+			"WHERE fingerprint = ?1 AND ip = ?2 AND time > ?3;" },
+	[SQL_DUPLICATE_TEXT] = { "ll",
+		"SELECT MAX(time) FROM posts WHERE fingerprint = ?1 AND time > ?2;" },
+	[SQL_COOLDOWN] = { "sl",
+		"SELECT MAX(time) FROM posts WHERE ip = ?1 AND time > ?2;" },
+	/* insertion */
+	[SQL_BEGIN] = { "", "BEGIN IMMEDIATE;" },
+	[SQL_COMMIT] = { "", "COMMIT;" },
+	[SQL_ROLLBACK] = { "", "ROLLBACK;" },
+	[SQL_NEXT_POST_ID] = { "s",
+		"UPDATE boards SET post_seq = post_seq + 1 "
+			"WHERE id = ?1 RETURNING post_seq;" },
+	[SQL_INSERT_THREAD] = { "slls",
+		"INSERT INTO active_threads(board_id, post_id, last_bump, status, ip) "
+			"VALUES(?1, ?2, ?3, 0, ?4);" },
+	[SQL_INSERT_POST] = { "slllllsssssslsl",
+		"INSERT INTO " /* optional fields bind as NULL */
+			"posts(board_id, parent_id, id, time, options, user_priv, del_pass, ip, "
+			      "name, trip, subject, comment, fingerprint, rendered, markup_ver) "
+		"VALUES(?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12, ?13, ?14, ?15);" },
+	/* thread statistics, maintained alongside each insert */
+	[SQL_INSERT_POSTER] = { "sls",
+		"INSERT OR IGNORE INTO thread_posters VALUES(?1, ?2, ?3);" },
+	[SQL_INSERT_STATS] = { "sl",
+		"INSERT INTO thread_stats VALUES(?1, ?2, 0, ?2, 1, 0);" },
+	[SQL_UPDATE_STATS] = { "lllsl", /* ?3 bump limit */
+		"UPDATE thread_stats SET replies = replies + 1, last_post = ?1, "
+			"posters = posters + ?2, bump_limit = (replies + 2 > ?3) "
+			"WHERE board_id = ?4 AND post_id = ?5;" },
+	[SQL_FETCH_POST] = { "sl",
+		"SELECT " POST_COLUMNS " FROM posts "
+			"WHERE board_id = ?1 AND id = ?2;" },
+	[SQL_DELETE_POST] = { "sl",
+		"DELETE FROM posts WHERE board_id = ?1 AND id = ?2;" },
+	[SQL_DELETE_THREAD] = { "sl",
+		"DELETE FROM posts WHERE board_id = ?1 AND parent_id = ?2;" },
+	[SQL_DELETE_ACTIVE] = { "sl",
+		"DELETE FROM active_threads WHERE board_id = ?1 AND post_id = ?2;" },
+	[SQL_DELETE_ARCHIVED] = { "sl",
+		"DELETE FROM archived_threads WHERE board_id = ?1 AND post_id = ?2;" },
+	[SQL_DELETE_STATS] = { "sl",
+		"DELETE FROM thread_stats WHERE board_id = ?1 AND post_id = ?2;" },
+	[SQL_DELETE_POSTERS] = { "sl",
+		"DELETE FROM thread_posters WHERE board_id = ?1 AND post_id = ?2;" },
+	/* backlinks to and from a thread, or a single post ?3 */
+	[SQL_DELETE_QUOTES] = { "sl",
+		"DELETE FROM quotes WHERE board_id = ?1 AND parent_id = ?2;" },
+	[SQL_DELETE_QUOTING] = { "sl",
+		"DELETE FROM quotes WHERE board_id = ?1 AND from_parent = ?2;" },
+	[SQL_DELETE_POST_QUOTES] = { "sll",
+		"DELETE FROM quotes WHERE board_id = ?1 AND parent_id = ?2 AND post_id = ?3;" },
+	[SQL_DELETE_POST_QUOTING] = { "sll",
+		"DELETE FROM quotes WHERE board_id = ?1 AND from_parent = ?2 AND from_id = ?3;" },
+	/* unique posters is a lifetime count, ?3 bump limit
+	 * bump_limit is set as SQL_UPDATE_STATS does, from the post count
+	 * after the delete, which is replies before it
+	 */
+	[SQL_UNCOUNT_POST] = { "sll",
+		"UPDATE thread_stats SET replies = replies - 1, last_post = "
+			"(SELECT MAX(id) FROM posts WHERE board_id = ?1 AND parent_id = ?2), "
+			"bump_limit = (replies > ?3) "
+			"WHERE board_id = ?1 AND post_id = ?2;" },
+	[SQL_BUMP_THREAD] = { "lsl",
+		"UPDATE active_threads SET last_bump = ?1 "
+			"WHERE board_id = ?2 AND post_id = ?3;" },
+	[SQL_ACTIVE_COUNT] = { "s",
+		"SELECT COUNT(*) FROM active_threads WHERE board_id = ?1;" },
+	/* pruning, threads past the first ?2 by index ranking are stale
+	 * archive summary: reply count and OP digest
+	 * ?4 ?5 characters of subject and comment are kept, enough for
+	 * the digest's escape codes, it's cut to length by xss_truncate()
+	 */
+	[SQL_ARCHIVE_STALE] = { "sllll",
+		"INSERT INTO archived_threads"
+			"(board_id, post_id, expiry, replies, name, trip, subject, comment) "
+		"SELECT ?1, stale.post_id, ?3, replies, "
+			"name, trip, substr(subject, 1, ?4), substr(comment, 1, ?5) "
+		"FROM (SELECT post_id FROM active_threads WHERE board_id = ?1 "
+			"ORDER BY last_bump DESC, post_id DESC LIMIT -1 OFFSET ?2) AS stale "
+		"INNER JOIN thread_stats "
+			"ON thread_stats.board_id = ?1 AND thread_stats.post_id = stale.post_id "
+		"INNER JOIN posts ON posts.board_id = ?1 AND posts.id = stale.post_id;" },
+	[SQL_DELETE_STALE] = { "sl",
+		"DELETE FROM active_threads WHERE board_id = ?1 AND post_id IN "
+			"(SELECT post_id FROM active_threads WHERE board_id = ?1 "
+				"ORDER BY last_bump DESC, post_id DESC LIMIT -1 OFFSET ?2);" },
+	/* expiry, oldest ?3 archived threads past their expiration date ?2 */
+	[SQL_DELETE_EXPIRED_POSTS] = { "sll",
+		"DELETE FROM posts WHERE board_id = ?1 AND parent_id IN "
+			"(SELECT post_id FROM archived_threads WHERE board_id = ?1 AND expiry < ?2 "
+				"ORDER BY expiry, post_id LIMIT ?3);" },
+	[SQL_DELETE_EXPIRED_STATS] = { "sll",
+		"DELETE FROM thread_stats WHERE board_id = ?1 AND post_id IN "
+			"(SELECT post_id FROM archived_threads WHERE board_id = ?1 AND expiry < ?2 "
+				"ORDER BY expiry, post_id LIMIT ?3);" },
+	[SQL_DELETE_EXPIRED_QUOTES] = { "sll",
+		"DELETE FROM quotes WHERE board_id = ?1 AND parent_id IN "
+			"(SELECT post_id FROM archived_threads WHERE board_id = ?1 AND expiry < ?2 "
+				"ORDER BY expiry, post_id LIMIT ?3);" },
+	[SQL_DELETE_EXPIRED_QUOTING] = { "sll",
+		"DELETE FROM quotes WHERE board_id = ?1 AND from_parent IN "
+			"(SELECT post_id FROM archived_threads WHERE board_id = ?1 AND expiry < ?2 "
+				"ORDER BY expiry, post_id LIMIT ?3);" },
+	[SQL_DELETE_EXPIRED_POSTERS] = { "sll",
+		"DELETE FROM thread_posters WHERE board_id = ?1 AND post_id IN "
+			"(SELECT post_id FROM archived_threads WHERE board_id = ?1 AND expiry < ?2 "
+				"ORDER BY expiry, post_id LIMIT ?3);" },
+	[SQL_DELETE_EXPIRED] = { "sll",
+		"DELETE FROM archived_threads WHERE board_id = ?1 AND post_id IN "
+			"(SELECT post_id FROM archived_threads WHERE board_id = ?1 AND expiry < ?2 "
+				"ORDER BY expiry, post_id LIMIT ?3);" },
+	/* resource fetching */
+	[SQL_BOARD_LIST] = { "",
+		"SELECT id, name, desc FROM boards ORDER BY id;" },
+	[SQL_THREAD] = { "sl",
+		"SELECT " POST_COLUMNS " FROM posts "
+			"WHERE board_id = ?1 AND parent_id = ?2 ORDER BY id ASC;" },
+	/* index page: ?2 threads per page, ?3 offset, ?4 reply preview
+	 * threads are ranked by last_bump, newest thread first on ties
+	 * posts are each thread's OP followed by its last ?4 replies,
+	 * found by seeking to the (?4 + 1)th newest post of the thread
+	 */
+	[SQL_INDEX_THREADS] = { "sll",
+		"SELECT active_threads.post_id, replies, last_post, posters, bump_limit "
+		"FROM active_threads INNER JOIN thread_stats "
+			"ON thread_stats.board_id = ?1 AND thread_stats.post_id = active_threads.post_id "
+		"WHERE active_threads.board_id = ?1 "
+			"ORDER BY last_bump DESC, active_threads.post_id DESC LIMIT ?2 OFFSET ?3;" },
+	[SQL_INDEX_POSTS] = { "slll",
+		"WITH page AS ("
+			"SELECT post_id, last_bump FROM active_threads WHERE board_id = ?1 "
+				"ORDER BY last_bump DESC, post_id DESC LIMIT ?2 OFFSET ?3) "
+		"SELECT " POST_COLUMNS ", last_bump FROM page INNER JOIN posts "
+			"ON posts.board_id = ?1 AND posts.id = page.post_id "
+		"UNION ALL "
+		"SELECT " POST_COLUMNS ", last_bump FROM page INNER JOIN posts "
+			"ON posts.board_id = ?1 AND posts.parent_id = page.post_id "
+			"AND posts.id > MAX(page.post_id, IFNULL("
+				"(SELECT id FROM posts AS r "
+					"WHERE r.board_id = ?1 AND r.parent_id = page.post_id "
+					"ORDER BY r.id DESC LIMIT 1 OFFSET ?4), 0)) "
+		"ORDER BY 15 DESC, 2 DESC, 3 ASC;" },
+	/* catalog: every active thread in ranking order with its OP digest,
+	 * ?2 threads, ?3 characters of the OP comment, cut to length by xss_truncate()
+	 */
+	[SQL_CATALOG] = { "sll",
+		"SELECT active_threads.post_id, last_bump, replies, bump_limit, "
+			"posts.subject, substr(posts.comment, 1, ?3) "
+		"FROM active_threads INNER JOIN thread_stats "
+			"ON thread_stats.board_id = ?1 AND thread_stats.post_id = active_threads.post_id "
+		"INNER JOIN posts ON posts.board_id = ?1 AND posts.id = active_threads.post_id "
+		"WHERE active_threads.board_id = ?1 "
+			"ORDER BY last_bump DESC, active_threads.post_id DESC LIMIT ?2;" },
+	[SQL_ARCHIVED_COUNT] = { "s",
+		"SELECT COUNT(*) FROM archived_threads WHERE board_id = ?1;" },
+	/* archive page: keyset cursor (?2, ?3) is the last row shown, ?4 rows */
+	[SQL_ARCHIVE_PAGE] = { "slll",
+		"SELECT post_id, expiry, replies, name, trip, subject, comment "
+		"FROM archived_threads WHERE board_id = ?1 AND (expiry, post_id) < (?2, ?3) "
+			"ORDER BY expiry DESC, post_id DESC LIMIT ?4;" },
+	/* full-text search: ?1 FTS5 query, ?2 results per page, ?3 offset
+	 * ?5 board, NULL for every board
+	 * BM25 ranked with subject matches weighted above comment matches,
+	 * only the newest ?4 matches are ranked so common words stay cheap
+	 * matched terms are wrapped in \x01 and \x02, see search.c
+	 */
+	[SQL_SEARCH] = { "sllls",
+		"WITH recent AS ("
+			"SELECT posts.rowid AS id FROM posts_search "
+				"INNER JOIN posts ON posts.rowid = posts_search.rowid "
+				"WHERE posts_search MATCH ?1 AND (?5 IS NULL OR posts.board_id = ?5) "
+				"ORDER BY posts_search.rowid DESC LIMIT ?4) "
+		"SELECT posts.board_id, posts.parent_id, posts.id, posts.time, "
+			"highlight(posts_search, 1, char(1), char(2)), "
+			"snippet(posts_search, 2, char(1), char(2), '...', 24) "
+		"FROM posts_search INNER JOIN posts ON posts.rowid = posts_search.rowid "
+		"WHERE posts_search MATCH ?1 AND (?5 IS NULL OR posts.board_id = ?5) "
+			"AND posts_search.rowid >= (SELECT MIN(id) FROM recent) "
+			"ORDER BY bm25(posts_search, 0.0, 4.0, 1.0), posts_search.rowid DESC "
+			"LIMIT ?2 OFFSET ?3;" },
+	/* dump and restore, see dump.h */
+	[SQL_DUMP_BOARD] = { "s",
+		"SELECT id, name, desc, status, post_seq FROM boards WHERE id = ?1;" },
+	[SQL_DUMP_ACTIVE] = { "s",
+		"SELECT post_id, last_bump, status, ip FROM active_threads "
+			"WHERE board_id = ?1 ORDER BY post_id;" },
+	[SQL_DUMP_ARCHIVED] = { "s",
+		"SELECT post_id, expiry, replies, name, trip, subject, comment "
+		"FROM archived_threads WHERE board_id = ?1 ORDER BY post_id;" },
+	[SQL_DUMP_POSTS] = { "s",
+		"SELECT parent_id, id, time, options, user_priv, del_pass, ip, "
+			"name, trip, subject, comment "
+		"FROM posts WHERE board_id = ?1 ORDER BY id;" },
+	[SQL_RESTORE_BOARD] = { "sssll",
+		"INSERT INTO boards(id, name, desc, status, post_seq) "
+			"VALUES(?1, ?2, ?3, ?4, ?5);" },
+	[SQL_RESTORE_ACTIVE] = { "sllls",
+		"INSERT INTO active_threads(board_id, post_id, last_bump, status, ip) "
+			"VALUES(?1, ?2, ?3, ?4, ?5);" },
+	[SQL_RESTORE_ARCHIVED] = { "slllssss",
+		"INSERT INTO archived_threads"
+			"(board_id, post_id, expiry, replies, name, trip, subject, comment) "
+			"VALUES(?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8);" },
+	/* restored posts are staged in a temporary table without indexes
+	 * or triggers and moved into posts one batch at a time, a single
+	 * statement lets the search index take the whole batch at once
+	 */
+	[SQL_RESTORE_STAGE] = { "",
+		"CREATE TEMP TABLE IF NOT EXISTS restore_posts AS SELECT * FROM main.posts LIMIT 0;" },
+	[SQL_STAGE_POST] = { "slllllssssssl", /* markup is rendered once restored */
+		"INSERT INTO restore_posts(board_id, parent_id, id, time, options, user_priv, del_pass, ip, "
+			"name, trip, subject, comment, fingerprint, rendered, markup_ver) "
+		"VALUES(?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12, ?13, NULL, 0);" },
+	[SQL_RESTORE_POSTS] = { "",
+		"INSERT INTO main.posts SELECT * FROM restore_posts ORDER BY board_id, id;" },
+	[SQL_RESTORE_UNSTAGE] = { "", "DELETE FROM restore_posts;" },
+	/* thread statistics of a whole board, from its posts
+	 * ?2 bump limit
+	 */
+	[SQL_RESTORE_POSTERS] = { "s",
+		"INSERT OR IGNORE INTO thread_posters "
+			"SELECT DISTINCT board_id, parent_id, ip FROM posts WHERE board_id = ?1;" },
+	[SQL_RESTORE_STATS] = { "sl",
+		"INSERT OR REPLACE INTO thread_stats "
+			"SELECT board_id, parent_id, COUNT(*) - 1, MAX(id), COUNT(DISTINCT ip), COUNT(*) > ?2 "
+			"FROM posts WHERE board_id = ?1 GROUP BY parent_id;" },
+	[SQL_PURGE_POSTS] = { "s", "DELETE FROM posts WHERE board_id = ?1;" },
+	[SQL_PURGE_STATS] = { "s", "DELETE FROM thread_stats WHERE board_id = ?1;" },
+	[SQL_PURGE_POSTERS] = { "s", "DELETE FROM thread_posters WHERE board_id = ?1;" },
+	[SQL_PURGE_QUOTES] = { "s", "DELETE FROM quotes WHERE board_id = ?1;" },
+	[SQL_PURGE_ACTIVE] = { "s", "DELETE FROM active_threads WHERE board_id = ?1;" },
+	[SQL_PURGE_ARCHIVED] = { "s", "DELETE FROM archived_threads WHERE board_id = ?1;" },
+	[SQL_PURGE_BOARD] = { "s", "DELETE FROM boards WHERE id = ?1;" },
+	/* linkquote resolution: ?1 JSON array of [board_id, id] pairs
+	 * CROSS JOIN keeps the pairs as the outer loop so every pair is a
+	 * primary key lookup, which some SQLite versions won't plan for IN
+	 */
+	[SQL_RESOLVE_QUOTES] = { "s",
+		"SELECT posts.board_id, posts.id, posts.parent_id FROM json_each(?1) AS quoted "
+			"CROSS JOIN posts ON posts.board_id = json_extract(quoted.value, '$[0]') "
+			"AND posts.id = json_extract(quoted.value, '$[1]');" },
+	/* markup rebuild: keyset cursor ?1 is the last rowid rendered,
+	 * ?2 current markup version, ?3 rows
+	 */
+	[SQL_STALE_MARKUP] = { "llls", /* ?4 board, NULL for every board */
+		"SELECT rowid, board_id, parent_id, id, comment FROM posts "
+			"WHERE rowid > ?1 AND markup_ver != ?2 AND (?4 IS NULL OR board_id = ?4) "
+			"ORDER BY rowid LIMIT ?3;" },
+	[SQL_UPDATE_MARKUP] = { "sll",
+		"UPDATE posts SET rendered = ?1, markup_ver = ?2 WHERE rowid = ?3;" },
+	/* backlinks */
+	[SQL_INSERT_QUOTE] = { "sllll",
+		"INSERT OR IGNORE INTO quotes(board_id, parent_id, post_id, from_parent, from_id) "
+			"VALUES(?1, ?2, ?3, ?4, ?5);" },
+	[SQL_THREAD_BACKLINKS] = { "sl",
+		"SELECT post_id, from_parent, from_id FROM quotes "
+			"WHERE board_id = ?1 AND parent_id = ?2 ORDER BY post_id, from_id;" },
+	[SQL_POST_BACKLINKS] = { "sll",
+		"SELECT post_id, from_parent, from_id FROM quotes "
+			"WHERE board_id = ?1 AND parent_id = ?2 AND post_id = ?3 ORDER BY from_id;" }
+};
+static_assert(static_size(registry) == SQL_STATEMENTS); /* size check */
+
+/* registry is bound to a single connection at a time */
+static sqlite3 *registry_db = NULL;
+static sqlite3_stmt *prepared[SQL_STATEMENTS] = { 0 };
+
+static void db_finalize(void)
 {
-	/* rewrites SQL statements to fetch row count instead */
-	static const char *ins = "COUNT(*)";
-	static const unsigned offset = static_size(ins);
-	char *out = (char *) malloc(sizeof(char) * strlen(str) + offset + 1);
-	unsigned i, j = 0;
-	for (i = 0; str[i]; i++)
+	/* release every prepared statement */
+	unsigned i;
+	for (i = 0; i < SQL_STATEMENTS; i++)
 	{
-		if (str[i] == '*')
-		{
-			memcpy(&out[j], ins, offset);
-			j += offset;
-		}
-		else
-			out[j++] = str[i];
+		sqlite3_finalize(prepared[i]);
+		prepared[i] = NULL;
 	}
-	out[j] = '\0';
-	return out;
+	registry_db = NULL;
+}
+
+static sqlite3_stmt *db_vstatement(sqlite3 *db, enum statement id, va_list args)
+{
+	/* fetch statement from registry, preparing it on first use
+	 * returned statement is reset with fresh bindings
+	 * returns NULL if statement could not be prepared
+	 */
+	if (db != registry_db) /* new connection */
+	{
+		db_finalize();
+		registry_db = db;
+	}
+	sqlite3_stmt *stmt = prepared[id];
+	if (!stmt)
+	{
+		if (sqlite3_prepare_v3(db, registry[id].sql, -1,
+		                       SQLITE_PREPARE_PERSISTENT, &stmt, NULL))
+			return NULL;
+		prepared[id] = stmt;
+	}
+	else
+	{
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+	}
+	/* strings are bound without copying and must outlive
+	 * the next sqlite3_step() on this statement
+	 */
+	const char *b = registry[id].bind;
+	int i;
+	for (i = 1; *b; i++, b++)
+	{
+		if (*b == 's')
+			sqlite3_bind_text(stmt, i, va_arg(args, const char *), -1, SQLITE_STATIC);
+		else if (*b == 'l')
+			sqlite3_bind_int64(stmt, i, va_arg(args, long));
+	}
+	return stmt;
+}
+
+sqlite3_stmt *db_statement(sqlite3 *db, enum statement id, ...)
+{
+	/* reset-and-rebind accessor for registry statements
+	 * caller steps the statement and should sqlite3_reset() it when done
+	 * so it doesn't hold a read transaction open
+	 */
+	va_list args;
+	va_start(args, id);
+	sqlite3_stmt *stmt = db_vstatement(db, id, args);
+	va_end(args);
+	return stmt;
+}
+
+/* lock wait metrics
+ * per request, and per process for the lifetime of a FastCGI process
+ */
+static struct {
+	long limit_ms; /* give up after waiting this long */
+	long event_ms; /* spent on current lock */
+	unsigned long seed; /* backoff jitter */
+	unsigned long retries, ms; /* this request */
+	unsigned long requests, waited, total_ms; /* this process */
+} lock;
+
+void db_pause(long ms)
+{
+	/* sleep for ms, eg. to yield the write lock to waiting requests */
+	struct timespec ts = { ms / 1000, (ms % 1000) * 1000000 };
+	nanosleep(&ts, NULL);
+}
+
+static int db_busy_backoff(void *arg, int count)
+{
+	/* busy handler, jittered exponential backoff
+	 * sleeps about 1, 2, 4 ... ms up to BUSY_MAX_SLEEP_MS, randomized by
+	 * up to 50% either way so waiting processes don't retry in lockstep
+	 * returns 0 to give up once limit_ms has been spent on this lock
+	 */
+	(void) arg;
+	if (!count) /* new lock */
+		lock.event_ms = 0;
+	long base = min(1L << min(count, 16), BUSY_MAX_SLEEP_MS);
+	lock.seed = lock.seed * 1103515245 + 12345;
+	long ms = base / 2 + (long) ((lock.seed >> 16) % (base + 1));
+	ms = min(ms, lock.limit_ms - lock.event_ms);
+	if (ms <= 0)
+		return 0;
+	db_pause(ms);
+	lock.event_ms += ms;
+	lock.ms += ms;
+	lock.retries++;
+	return 1;
+}
+
+void db_busy_timeout(sqlite3 *db, long ms)
+{
+	/* wait up to ms for a lock with backoff, see db_busy_backoff() */
+	lock.limit_ms = ms;
+	sqlite3_busy_handler(db, db_busy_backoff, NULL);
+}
+
+int db_open(sqlite3 **db, int flags)
+{
+	/* open DATABASE_LOC and apply connection tuning
+	 * shared by every binary, flags as in sqlite3_open_v2()
+	 * returns error code, *db is NULL on failure
+	 */
+	int err;
+	if ((err = sqlite3_open_v2(DATABASE_LOC, db, flags, NULL)))
+	{
+		sqlite3_close(*db);
+		*db = NULL;
+		return err;
+	}
+	lock.seed ^= time(NULL) ^ (unsigned long) *db;
+	db_busy_timeout(*db, BUSY_TIMEOUT_MS);
+	char *pragma = sql_generate(
+		"PRAGMA mmap_size=%ld;"
+		"PRAGMA cache_size=-%ld;" /* KiB */
+		"PRAGMA temp_store=MEMORY;", (long) DB_MMAP_SIZE, (long) DB_CACHE_KIB);
+	err = sqlite3_exec(*db, pragma, NULL, NULL, NULL);
+	free(pragma);
+	/* fsync on checkpoint only, still durable against crashes under WAL */
+	sqlite3_stmt *stmt;
+	if (!err && !(err = sqlite3_prepare_v2(*db, "PRAGMA journal_mode;", -1, &stmt, NULL)))
+	{
+		int wal = (sqlite3_step(stmt) == SQLITE_ROW
+		           && !strcmp((const char *) sqlite3_column_text(stmt, 0), "wal"));
+		sqlite3_finalize(stmt);
+		if (wal)
+			err = sqlite3_exec(*db, "PRAGMA synchronous=NORMAL;", NULL, NULL, NULL);
+	}
+	return err;
 }
 
-static int db_transaction(sqlite3 *db, const char *sql)
+void db_lock_report(const char *ident)
+{
+	/* end of request, log time spent waiting on locks to stderr
+	 * lighttpd writes CGI stderr to its error log
+	 */
+	lock.requests++;
+	if (lock.retries)
+	{
+		lock.waited++;
+		lock.total_ms += lock.ms;
+		fprintf(stderr, "%s: waited %lums on locks, %lu retries "
+		                "(%lu of %lu requests waited, %lums total)\n", ident,
+		        lock.ms, lock.retries, lock.waited, lock.requests, lock.total_ms);
+	}
+	lock.retries = lock.ms = 0;
+}
+
+void db_close(sqlite3 *db)
+{
+	/* finalize registry and close connection */
+	if (db == registry_db)
+		db_finalize();
+	sqlite3_close(db);
+}
+
+int db_transaction(sqlite3 *db, enum statement id, ...)
 {
 	/* 1-shot SQL INSERT/UPDATE transaction
 	 * returns error code
 	 */
-	sqlite3_stmt *stmt;
-	sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+	va_list args;
+	va_start(args, id);
+	sqlite3_stmt *stmt = db_vstatement(db, id, args);
+	va_end(args);
+	if (!stmt)
+		return sqlite3_errcode(db);
 	int err = sqlite3_step(stmt);
-	sqlite3_finalize(stmt);
+	sqlite3_reset(stmt);
 	return (err == SQLITE_DONE) ? SQLITE_OK : err;
 }
 
-long db_retrieval(sqlite3 *db, const char *sql)
+long db_retrieval(sqlite3 *db, enum statement id, ...)
 {
 	/* 1-shot SQL SELECT integer value retrieval
 	 * returns first value from first column
 	 */
-	sqlite3_stmt *stmt;
-	sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-	sqlite3_step(stmt);
-	int value = sqlite3_column_int(stmt, 0);
-	sqlite3_finalize(stmt);
+	va_list args;
+	va_start(args, id);
+	sqlite3_stmt *stmt = db_vstatement(db, id, args);
+	va_end(args);
+	long value = 0;
+	if (stmt && sqlite3_step(stmt) == SQLITE_ROW)
+		value = sqlite3_column_int64(stmt, 0);
+	sqlite3_reset(stmt);
 	return value;
 }
 
-long *db_array_retrieval(sqlite3 *db, const char *sql, unsigned n)
+long *db_array_retrieval(sqlite3 *db, unsigned n, enum statement id, ...)
 {
 	/* 1-shot SQL SELECT integer array retrieval
 	 * retrieves n integer values from first column
 	 */
-	sqlite3_stmt *stmt;
-	sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-	sqlite3_step(stmt);
-	long *arr = (long *) malloc(sizeof(long) * n);
+	va_list args;
+	va_start(args, id);
+	sqlite3_stmt *stmt = db_vstatement(db, id, args);
+	va_end(args);
+	long *arr = (long *) calloc(n, sizeof(long));
 	unsigned i;
-	for (i = 0; i < n; i++)
-	{
-		arr[i] = sqlite3_column_int(stmt, 0);
-		sqlite3_step(stmt);
-	}
-	sqlite3_finalize(stmt);
+	for (i = 0; stmt && i < n && sqlite3_step(stmt) == SQLITE_ROW; i++)
+		arr[i] = sqlite3_column_int64(stmt, 0);
+	sqlite3_reset(stmt);
 	return arr;
 }
 
@@ -175,18 +634,9 @@ unsigned db_status_flags(sqlite3 *db, const char *board_id, const long id)
 	/* returns board status flags
 	 * if parent_id is provided, thread status flags are returned instead
 	 */
-	static const char *const sql[] = {
-		"SELECT status FROM boards WHERE id = \"%s\";",
-		"SELECT status FROM active_threads "
-			"WHERE board_id = \"%s\" AND post_id = %ld;"
-	};
-	unsigned opt = (id < 0) ? 0 : 1; /* select mode */
-	const char *stmt = sql[opt];
-	char *cmd = (!opt) ? sql_generate(stmt, board_id)
-	                   : sql_generate(stmt, board_id, id);
-	unsigned status = db_retrieval(db, cmd);
-	free(cmd);
-	return status;
+	if (id < 0) /* select mode */
+		return db_retrieval(db, SQL_BOARD_STATUS, board_id);
+	return db_retrieval(db, SQL_THREAD_STATUS, board_id, id);
 }
 
 long db_find_parent(sqlite3 *db, const char *board_id, const long id)
@@ -194,37 +644,19 @@ long db_find_parent(sqlite3 *db, const char *board_id, const long id)
 	/* return parent_id of requested post number
 	 * if post doesn't exist, return 0
 	 */
-	static const char *sql =
-		"SELECT parent_id FROM posts "
-			"WHERE board_id = \"%s\" AND id = %ld;";
-	char *cmd = sql_generate(sql, board_id, id);
-	long parent_id = db_retrieval(db, cmd);
-	free(cmd);
-	return parent_id;
+	return db_retrieval(db, SQL_FIND_PARENT, board_id, id);
 }
 
 int db_active_status(sqlite3 *db, const char *board_id, const long id)
 {
 	/* return non-zero if requested thread_id is active */
-	static const char *sql =
-		"SELECT COUNT(*) FROM active_threads "
-			"WHERE board_id = \"%s\" AND post_id = %ld;";
-	char *cmd = sql_generate(sql, board_id, id);
-	int exists = db_retrieval(db, cmd);
-	free(cmd);
-	return exists;
+	return db_retrieval(db, SQL_ACTIVE_STATUS, board_id, id);
 }
 
 int db_archive_status(sqlite3 *db, const char *board_id, const long id)
 {
 	/* return non-zero if requested thread_id is archived */
-	static const char *sql =
-		"SELECT COUNT(*) FROM archived_threads "
-			"WHERE board_id = \"%s\" AND post_id = %ld;";
-	char *cmd = sql_generate(sql, board_id, id);
-	long status = db_retrieval(db, cmd);
-	free(cmd);
-	return status;
+	return db_retrieval(db, SQL_ARCHIVE_STATUS, board_id, id);
 }
 
 long db_total_posts(sqlite3 *db, const char *board_id, const long id)
@@ -232,18 +664,29 @@ long db_total_posts(sqlite3 *db, const char *board_id, const long id)
 	/* returns lifetime post count of board_id
 	 * if parent_id is provided, post count of that thread is returned
 	 */
-	static const char *const sql[] = {
-		"SELECT MAX(id) FROM posts WHERE board_id = \"%s\";",
-		"SELECT COUNT(*) FROM posts "
-			"WHERE board_id = \"%s\" AND parent_id = %ld;"
-	};
-	unsigned opt = (id < 0) ? 0 : 1; /* select mode */
-	const char *stmt = sql[opt];
-	char *cmd = (!opt) ? sql_generate(stmt, board_id)
-	                   : sql_generate(stmt, board_id, id);
-	long post_count = db_retrieval(db, cmd);
-	free(cmd);
-	return post_count;
+	if (id < 0) /* select mode */
+		return db_retrieval(db, SQL_BOARD_POSTS, board_id);
+	return db_retrieval(db, SQL_THREAD_POSTS, board_id, id);
+}
+
+int db_thread_stats(sqlite3 *db, const char *board_id, const long id, struct thread_stats *ts)
+{
+	/* fetch statistics of requested thread
+	 * returns non-zero if found, otherwise ts is zeroed
+	 */
+	int found = 0;
+	memset(ts, 0, sizeof(struct thread_stats));
+	sqlite3_stmt *stmt = db_statement(db, SQL_THREAD_STATS, board_id, id);
+	if (stmt && sqlite3_step(stmt) == SQLITE_ROW)
+	{
+		ts->replies = sqlite3_column_int64(stmt, 0);
+		ts->last_post = sqlite3_column_int64(stmt, 1);
+		ts->posters = sqlite3_column_int64(stmt, 2);
+		ts->bump_limit = sqlite3_column_int(stmt, 3);
+		found = 1;
+	}
+	sqlite3_reset(stmt);
+	return found;
 }
 
 #ifdef NDEBUG /* flood control */
@@ -251,42 +694,32 @@ long db_total_posts(sqlite3 *db, const char *board_id, const long id)
 long db_user_threads(sqlite3 *db, const char *board_id, const char *ip_addr)
 {
 	/* returns number of active threads from this IP */
-	static const char *sql =
-		"SELECT COUNT(*) FROM active_threads "
-			"INNER JOIN posts ON active_threads.post_id = posts.id "
-			"WHERE posts.board_id = \"%s\" AND posts.ip = \"%s\";";
-	char *cmd = sql_generate(sql, board_id, ip_addr);
-	long count = db_retrieval(db, cmd);
-	free(cmd);
-	return count;
+	return db_retrieval(db, SQL_USER_THREADS, board_id, ip_addr);
 }
 
 long db_duplicate_post(sqlite3 *db, const char *text, const char *ip_addr)
 {
-	/* determines elapsed seconds since user made an identical post
+	/* determines seconds left before user may repeat an identical post
 	 * identical post detection is global across all boards
+	 * posts are matched by fingerprint, see text_fingerprint()
+	 * if IDENTICAL_TEXT_SEC is set, the same text from any IP is refused too
 	 */
 	const long current_time = time(NULL);
-	const long time_frame = current_time - IDENTICAL_POST_SEC;
+	const long fingerprint = text_fingerprint(text);
 	long timer = IDENTICAL_POST_SEC;
-	struct resource res;
-	static const char *sql =
-		"SELECT * FROM posts WHERE time > %ld AND ip = \"%s\" "
-			"ORDER BY time DESC;";
-	char *cmd = sql_generate(sql, time_frame, ip_addr);
-	unsigned posts = db_resource_fetch(db, &res, cmd);
-	free(cmd);
-	unsigned i;
-	for (i = 0; i < posts; i++)
+	long last_post = db_retrieval(db, SQL_DUPLICATE_POST, fingerprint, ip_addr,
+	                              current_time - IDENTICAL_POST_SEC);
+	if (last_post) /* posted within time frame */
+		timer = current_time - last_post;
+	long wait = IDENTICAL_POST_SEC - timer;
+	if (IDENTICAL_TEXT_SEC > 0 && !wait)
 	{
-		if (!strcmp(res.arr[i].comment, text))
-		{
-			timer = current_time - res.arr[i].time;
-			break;
-		}
+		last_post = db_retrieval(db, SQL_DUPLICATE_TEXT, fingerprint,
+		                         current_time - IDENTICAL_TEXT_SEC);
+		if (last_post)
+			wait = IDENTICAL_TEXT_SEC - (current_time - last_post);
 	}
-	db_resource_free(&res);
-	return IDENTICAL_POST_SEC - timer;
+	return wait;
 }
 
 long db_cooldown_timer(sqlite3 *db, const char *ip_addr)
@@ -297,73 +730,73 @@ long db_cooldown_timer(sqlite3 *db, const char *ip_addr)
 	const long current_time = time(NULL);
 	const long time_frame = current_time - COOLDOWN_SEC;
 	long timer = COOLDOWN_SEC;
-	struct resource res; /* fetch newest posts only */
-	static const char *sql = "SELECT * FROM posts WHERE time > %ld;";
-	char *cmd = sql_generate(sql, time_frame);
-	db_resource_fetch(db, &res, cmd);
-	free(cmd);
-	int i;
-	for (i = res.count - 1; i >= 0; i--)
-	{
-		if (!strcmp(ip_addr, res.arr[i].ip))
-		{
-			timer = current_time - res.arr[i].time;
-			break;
-		}
-	}
-	db_resource_free(&res);
+	long last_post = db_retrieval(db, SQL_COOLDOWN, ip_addr, time_frame);
+	if (last_post) /* posted within time frame */
+		timer = current_time - last_post;
 	return COOLDOWN_SEC - timer;
 }
 
 #endif
 
+int db_begin(sqlite3 *db)
+{
+	/* open write transaction, taking the write lock immediately
+	 * returns error code
+	 */
+	return db_transaction(db, SQL_BEGIN);
+}
+
+int db_commit(sqlite3 *db)
+{
+	/* commit open transaction
+	 * returns error code
+	 */
+	return db_transaction(db, SQL_COMMIT);
+}
+
+void db_rollback(sqlite3 *db)
+{
+	/* abandon open transaction, if any */
+	if (!sqlite3_get_autocommit(db))
+		db_transaction(db, SQL_ROLLBACK);
+}
+
+long db_next_post_id(sqlite3 *db, const char *board_id)
+{
+	/* allocate next post id from the board's post sequence
+	 * should be called between db_begin() and db_commit()
+	 * so the id is released again if the insert is rolled back
+	 * returns 0 on failure
+	 */
+	return db_retrieval(db, SQL_NEXT_POST_ID, board_id);
+}
+
 int db_post_insert(sqlite3 *db, struct post *cm)
 {
 	/* insert new post into database
 	 * if parent_id and id are the same, create new thread
+	 * thread statistics are updated in the same transaction
+	 * should be called between db_begin() and db_commit()
+	 * cm->rendered is stored as markup of the current MARKUP_VER
 	 * returns error code
 	 */
-	static const char *const sql[] = {
-		"INSERT INTO active_threads VALUES(\"%s\", %ld, %ld, %d);",
-		"INSERT INTO "
-			"posts(board_id, parent_id, id, time, options, "
-			      "user_priv, del_pass, ip, comment) "
-		"VALUES(\"%s\", %ld, %ld, %ld, %d, %d, \"%s\", \"%s\", \"%s\");",
-		/* optional fields */
-		"UPDATE posts SET subject = \"%s\" "
-			"WHERE board_id = \"%s\" AND id = %ld;",
-		"UPDATE posts SET name = \"%s\" "
-			"WHERE board_id = \"%s\" AND id = %ld;",
-		"UPDATE posts SET trip = \"%s\" "
-			"WHERE board_id = \"%s\" AND id = %ld;",
-	};
-	char *cmd[static_size(sql)] = { 0 }; /* buffer */
 	int err = 0;
 	if (cm->parent_id == cm->id) /* new thread creation */
-	{
-		cmd[0] = sql_generate(sql[0], cm->board_id, cm->id, cm->time, 0);
-		if ((err = db_transaction(db, cmd[0])))
-			goto end;
-	}
-	cmd[1] = sql_generate(sql[1],
-		cm->board_id, cm->parent_id, cm->id, cm->time,
-		cm->options, cm->user_priv, cm->del_pass, cm->ip, cm->comment
-	);
-	if ((err = db_transaction(db, cmd[1]))) /* mandatory fields */
-		goto end;
-	const char *const field[] = { cm->subject, cm->name, cm->trip };
-	unsigned i;
-	for (i = 0; i < static_size(field); i++) /* optional fields */
-	{
-		if (field[i])
-		{
-			cmd[i+2] = sql_generate(sql[i+2], field[i], cm->board_id, cm->id);
-			err = db_transaction(db, cmd[i+2]);
-		}
-	}
-	end: for (i = 0; i < static_size(sql); i++)
-		free((!cmd[i]) ? NULL : cmd[i]);
-	return err;
+		if ((err = db_transaction(db, SQL_INSERT_THREAD, cm->board_id, cm->id, cm->time, cm->ip)))
+			return err;
+	if ((err = db_transaction(db, SQL_INSERT_POST,
+		cm->board_id, cm->parent_id, cm->id, cm->time, (long) cm->options,
+		(long) cm->user_priv, cm->del_pass, cm->ip,
+		cm->name, cm->trip, cm->subject, cm->comment, text_fingerprint(cm->comment),
+		cm->rendered, (long) ((!cm->rendered) ? 0 : MARKUP_VER))))
+		return err;
+	if ((err = db_transaction(db, SQL_INSERT_POSTER, cm->board_id, cm->parent_id, cm->ip)))
+		return err;
+	if (cm->parent_id == cm->id)
+		return db_transaction(db, SQL_INSERT_STATS, cm->board_id, cm->id);
+	long new_poster = sqlite3_changes(db); /* ignored if already posted here */
+	return db_transaction(db, SQL_UPDATE_STATS, cm->id, new_poster,
+	                      (long) THREAD_BUMP_LIMIT, cm->board_id, cm->parent_id);
 }
 
 int db_post_delete(sqlite3 *db, const char *board_id, const long id)
@@ -372,114 +805,134 @@ int db_post_delete(sqlite3 *db, const char *board_id, const long id)
 	 * if a parent thread, delete all child posts
 	 * returns non-zero if successful
 	 */
-	static const char *const sql[] = {
-		"DELETE FROM posts WHERE board_id = \"%s\" AND id = %ld;",
-		/* parent thread delete */
-		"SELECT * FROM posts WHERE board_id = \"%s\" AND id = %ld;",
-		"DELETE FROM active_threads WHERE board_id = \"%s\" AND post_id = %ld;",
-		"DELETE FROM archived_threads WHERE board_id = \"%s\" AND post_id = %ld;",
-		"DELETE FROM posts WHERE board_id = \"%s\" AND parent_id = %ld;"
-	};
-	char *cmd[static_size(sql)] = { 0 };
-	unsigned i, success = 0;
-	for (i = 0; i < static_size(sql); i++)
-		cmd[i] = sql_generate(sql[i], board_id, id);
-	struct resource res;
-	db_resource_fetch(db, &res, cmd[1]);
-	if (res.count)
+	unsigned success = 0;
+	long parent_id = db_find_parent(db, board_id, id);
+	if (parent_id)
 	{
-		if (res.arr[0].id == res.arr[0].parent_id) /* parent thread */
+		if (parent_id == id) /* parent thread */
 		{
 			int is_active = db_active_status(db, board_id, id);
-			success = !db_transaction(db, (is_active) ? cmd[2] : cmd[3]);
-			success = !db_transaction(db, cmd[4]);
+			success = !db_transaction(db, (is_active) ? SQL_DELETE_ACTIVE
+			                                          : SQL_DELETE_ARCHIVED, board_id, id);
+			success = !db_transaction(db, SQL_DELETE_THREAD, board_id, id);
+			success = !db_transaction(db, SQL_DELETE_STATS, board_id, id);
+			success = !db_transaction(db, SQL_DELETE_POSTERS, board_id, id);
+			success = !db_transaction(db, SQL_DELETE_QUOTES, board_id, id);
+			success = !db_transaction(db, SQL_DELETE_QUOTING, board_id, id);
+		}
+		else /* single post */
+		{
+			success = !db_transaction(db, SQL_DELETE_POST, board_id, id);
+			success = !db_transaction(db, SQL_DELETE_POST_QUOTES, board_id, parent_id, id);
+			success = !db_transaction(db, SQL_DELETE_POST_QUOTING, board_id, parent_id, id);
+			success = !db_transaction(db, SQL_UNCOUNT_POST, board_id, parent_id,
+			                          (long) THREAD_BUMP_LIMIT);
 		}
-		else
-			success = !db_transaction(db, cmd[0]); /* single post */
 	}
-	db_resource_free(&res);
-	for (i = 0; i < static_size(sql); i++)
-		free((!cmd[i]) ? NULL : cmd[i]);
 	return success;
 }
 
 int db_bump_parent(sqlite3 *db, const char *board_id, const long id)
 {
 	/* bump parent thread by updating it's last_bump timestamp
+	 * archived threads have no active_threads row to update
 	 * returns non-zero if thread bumped
 	 */
-	static const char *sql =
-		"UPDATE active_threads SET last_bump = %ld "
-			"WHERE board_id = \"%s\" AND post_id = %ld;";
-	int bumped = 0;
-	if (db_active_status(db, board_id, id)) /* eligible for bump? */
-	{
-		if (db_total_posts(db, board_id, id) <= THREAD_BUMP_LIMIT)
-		{
-			char *cmd = sql_generate(sql, time(NULL), board_id, id);
-			bumped = !db_transaction(db, cmd);
-			free(cmd);
-		}
-	}
-	return bumped;
+	struct thread_stats ts;
+	if (!db_thread_stats(db, board_id, id, &ts) || ts.bump_limit) /* eligible for bump? */
+		return 0;
+	return !db_transaction(db, SQL_BUMP_THREAD, (long) time(NULL), board_id, id)
+	       && sqlite3_changes(db);
 }
 
-int db_archive_oldest(sqlite3 *db, const char *board_id)
+int db_archive_oldest(sqlite3 *db, const char *board_id, long *archived)
 {
 	/* archive stale threads from active_threads
-	 * delete archived_threads past their expiration date
-	 * return non-zero if operations performed
-	 */
-	static const char *const sql[] = {
-		/* find stale threads */
-		"SELECT COUNT(*) FROM active_threads WHERE board_id = \"%s\";",
-		"SELECT post_id FROM active_threads WHERE board_id = \"%s\" "
-			"ORDER BY last_bump ASC;",
-		/* move thread to archive */
-		"INSERT INTO archived_threads VALUES(\"%s\", %ld, %ld);",
-		"DELETE FROM active_threads WHERE board_id = \"%s\" AND post_id = %ld;",
-		/* find expired archive threads */
-		"SELECT COUNT(*) FROM archived_threads WHERE board_id = \"%s\" AND expiry < %ld;",
-		"SELECT post_id FROM archived_threads WHERE board_id = \"%s\" AND expiry < %ld;"
+	 * a single statement over the whole set of stale threads
+	 * should be called between db_begin() and db_commit()
+	 * returns error code, number of threads archived in archived
+	 */
+	const long expire_time = time(NULL) + to_seconds(DAYS_TO_ARCHIVE);
+	int err;
+	*archived = 0;
+	if ((err = db_transaction(db, SQL_ARCHIVE_STALE, board_id, (long) MAX_ACTIVE_THREADS, expire_time,
+	                          (long) ARCHIVE_SUBJECT * ESCAPE_MAX, (long) ARCHIVE_DIGEST * ESCAPE_MAX)))
+		return err;
+	if ((*archived = sqlite3_changes(db)))
+		return db_transaction(db, SQL_DELETE_STALE, board_id, (long) MAX_ACTIVE_THREADS);
+	return 0;
+}
+
+int db_expire_oldest(sqlite3 *db, const char *board_id, long limit, long *expired)
+{
+	/* delete up to limit archived_threads past their expiration date
+	 * along with their posts and statistics, children first
+	 * should be called between db_begin() and db_commit()
+	 * returns error code, number of threads deleted in expired
+	 */
+	static const enum statement expire[] = {
+		SQL_DELETE_EXPIRED_POSTS, SQL_DELETE_EXPIRED_STATS,
+		SQL_DELETE_EXPIRED_POSTERS, SQL_DELETE_EXPIRED_QUOTES,
+		SQL_DELETE_EXPIRED_QUOTING, SQL_DELETE_EXPIRED
 	};
-	char *cmd[static_size(sql)] = { 0 };
-	time_t now = time(NULL);
-	time_t expire_time = now + to_seconds(DAYS_TO_ARCHIVE);
-	unsigned i, j, success = 0;
-	for (i = 0; i < 2; i++)
-		cmd[i] = sql_generate(sql[i], board_id);
-	long thread_count = db_retrieval(db, cmd[0]);
-	if (thread_count > MAX_ACTIVE_THREADS)
-	{
-		long stale = thread_count - MAX_ACTIVE_THREADS;
-		long *post_id = db_array_retrieval(db, cmd[1], stale);
-		for (i = 0; i < stale; i++)
-		{
-			/* archive and set expiration date */
-			cmd[2] = sql_generate(sql[2], board_id, post_id[i], expire_time);
-			cmd[3] = sql_generate(sql[3], board_id, post_id[i]);
-			for (j = 2; j < 4; j++)
-			{
-				success = !db_transaction(db, cmd[j]);
-				free(cmd[j]);
-				cmd[j] = NULL;
-			}
-		}
-		free((!post_id) ? NULL : post_id);
-	}
-	for (i = 4; i < 6; i++)
-		cmd[i] = sql_generate(sql[i], board_id, now);
-	long expired_count = db_retrieval(db, cmd[4]);
-	if (expired_count)
-	{
-		long *post_id = db_array_retrieval(db, cmd[5], expired_count);
-		for (i = 0; i < expired_count; i++)
-			success = db_post_delete(db, board_id, post_id[i]);
-		free((!post_id) ? NULL : post_id);
-	}
-	for (i = 0; i < static_size(sql); i++)
-		free(cmd[i]);
-	return success;
+	const long now = time(NULL);
+	int err;
+	unsigned i;
+	*expired = 0;
+	for (i = 0; i < static_size(expire); i++)
+		if ((err = db_transaction(db, expire[i], board_id, now, limit)))
+			return err;
+	*expired = sqlite3_changes(db);
+	return 0;
+}
+
+int db_restore_stage(sqlite3 *db)
+{
+	/* create staging table for SQL_STAGE_POST
+	 * returns error code
+	 */
+	return db_transaction(db, SQL_RESTORE_STAGE);
+}
+
+int db_restore_flush(sqlite3 *db)
+{
+	/* move staged posts into posts
+	 * should be called between db_begin() and db_commit()
+	 * returns error code
+	 */
+	int err;
+	if (!(err = db_transaction(db, SQL_RESTORE_POSTS)))
+		err = db_transaction(db, SQL_RESTORE_UNSTAGE);
+	return err;
+}
+
+int db_restore_stats(sqlite3 *db, const char *board_id)
+{
+	/* rebuild thread statistics of a freshly restored board
+	 * should be called between db_begin() and db_commit()
+	 * returns error code
+	 */
+	int err;
+	if (!(err = db_transaction(db, SQL_RESTORE_POSTERS, board_id)))
+		err = db_transaction(db, SQL_RESTORE_STATS, board_id, (long) THREAD_BUMP_LIMIT);
+	return err;
+}
+
+int db_board_purge(sqlite3 *db, const char *board_id)
+{
+	/* delete a board and everything on it, children first
+	 * should be called between db_begin() and db_commit()
+	 * returns error code
+	 */
+	static const enum statement purge[] = {
+		SQL_PURGE_POSTS, SQL_PURGE_STATS, SQL_PURGE_POSTERS, SQL_PURGE_QUOTES,
+		SQL_PURGE_ACTIVE, SQL_PURGE_ARCHIVED, SQL_PURGE_BOARD
+	};
+	int err = 0;
+	unsigned i;
+	for (i = 0; i < static_size(purge) && !err; i++)
+		err = db_transaction(db, purge[i], board_id);
+	return err;
 }
 
 long db_board_fetch(sqlite3 *db, struct board *ls)
@@ -487,25 +940,27 @@ long db_board_fetch(sqlite3 *db, struct board *ls)
 	/* fetch enumerated boardlist with description information
 	 * returns number of items fetched
 	 */
-	static const char *const sql[] = {
-		"SELECT COUNT(id) FROM boards;",
-		"SELECT id, name, desc FROM boards ORDER BY id;"
-	};
-	ls->count = db_retrieval(db, sql[0]);
-	if (ls->count)
+	unsigned capacity = 8;
+	ls->count = 0;
+	ls->arr = (struct entry *) malloc(sizeof(struct entry) * capacity);
+	sqlite3_stmt *stmt = db_statement(db, SQL_BOARD_LIST);
+	while (stmt && sqlite3_step(stmt) == SQLITE_ROW)
 	{
-		ls->arr = (struct entry *) malloc(sizeof(struct entry) * ls->count);
-		sqlite3_stmt *stmt;
-		sqlite3_prepare_v2(db, sql[1], -1, &stmt, NULL);
-		unsigned i;
-		for (i = 0; i < ls->count; i++)
+		if (ls->count == capacity) /* grow */
 		{
-			sqlite3_step(stmt);
-			ls->arr[i].id = strdup((char *) sqlite3_column_text(stmt, 0));
-			ls->arr[i].name = strdup((char *) sqlite3_column_text(stmt, 1));
-			ls->arr[i].desc = strdup((char *) sqlite3_column_text(stmt, 2));
+			capacity *= 2;
+			ls->arr = (struct entry *) realloc(ls->arr, sizeof(struct entry) * capacity);
 		}
-		sqlite3_finalize(stmt);
+		struct entry *e = &ls->arr[ls->count++];
+		e->id = strdup((char *) sqlite3_column_text(stmt, 0));
+		e->name = strdup((char *) sqlite3_column_text(stmt, 1));
+		e->desc = strdup((char *) sqlite3_column_text(stmt, 2));
+	}
+	sqlite3_reset(stmt);
+	if (!ls->count)
+	{
+		free(ls->arr);
+		ls->arr = NULL;
 	}
 	return ls->count;
 }
@@ -526,38 +981,55 @@ void db_board_free(struct board *ls)
 	}
 }
 
-long db_resource_fetch(sqlite3 *db, struct resource *res, const char *sql)
+static void db_post_row(sqlite3_stmt *stmt, struct post *p)
+{
+	/* copy current row of a POST_COLUMNS statement into post container */
+	p->board_id = strdup((char *) sqlite3_column_text(stmt, 0));
+	p->parent_id = sqlite3_column_int64(stmt, 1);
+	p->id = sqlite3_column_int64(stmt, 2);
+	p->time = sqlite3_column_int64(stmt, 3);
+	p->options = (unsigned char) sqlite3_column_int(stmt, 4);
+	p->user_priv = (unsigned char) sqlite3_column_int(stmt, 5);
+	p->del_pass = strdup((char *) sqlite3_column_text(stmt, 6));
+	p->ip = strdup((char *) sqlite3_column_text(stmt, 7));
+	p->name = strdup((char *) sqlite3_column_text(stmt, 8));
+	p->trip = strdup((char *) sqlite3_column_text(stmt, 9));
+	p->subject = strdup((char *) sqlite3_column_text(stmt, 10));
+	p->comment = strdup((char *) sqlite3_column_text(stmt, 11));
+	p->rendered = (sqlite3_column_int(stmt, 13) != MARKUP_VER) ? NULL /* stale */
+	            : strdup((char *) sqlite3_column_text(stmt, 12));
+}
+
+long db_resource_fetch(sqlite3 *db, struct resource *res, unsigned hint, enum statement id, ...)
 {
 	/* fetch enumerated post container that match requested params
 	 * returns number of items fetched
-	 * this automated version is intended for COUNT(*) compatible statements
+	 * statement must select POST_COLUMNS in order
+	 * statement is stepped once, results go into a buffer sized to
+	 * the caller's row count hint that doubles whenever it fills up
 	 */
-	char *row_count = sql_rowcount(sql);
-	res->count = db_retrieval(db, row_count); /* how many rows? */
-	free(row_count);
-	if (res->count)
+	static const unsigned DEFAULT_CAPACITY = 16;
+	va_list args;
+	va_start(args, id);
+	sqlite3_stmt *stmt = db_vstatement(db, id, args);
+	va_end(args);
+	unsigned capacity = (!hint) ? DEFAULT_CAPACITY : hint;
+	res->count = 0;
+	res->arr = (struct post *) malloc(sizeof(struct post) * capacity);
+	while (stmt && sqlite3_step(stmt) == SQLITE_ROW)
 	{
-		res->arr = (struct post *) malloc(sizeof(struct post) * res->count);
-		sqlite3_stmt *stmt;
-		sqlite3_prepare_v2(db, sql, -1, &stmt, NULL); /* fetch results */
-		unsigned i;
-		for (i = 0; i < res->count; i++)
+		if (res->count == capacity) /* grow */
 		{
-			sqlite3_step(stmt);
-			res->arr[i].board_id = strdup((char *) sqlite3_column_text(stmt, 0));
-			res->arr[i].parent_id = sqlite3_column_int(stmt, 1);
-			res->arr[i].id = sqlite3_column_int(stmt, 2);
-			res->arr[i].time = sqlite3_column_int(stmt, 3);
-			res->arr[i].options = (unsigned char) sqlite3_column_int(stmt, 4);
-			res->arr[i].user_priv = (unsigned char) sqlite3_column_int(stmt, 5);
-			res->arr[i].del_pass = strdup((char *) sqlite3_column_text(stmt, 6));
-			res->arr[i].ip = strdup((char *) sqlite3_column_text(stmt, 7));
-			res->arr[i].name = strdup((char *) sqlite3_column_text(stmt, 8));
-			res->arr[i].trip = strdup((char *) sqlite3_column_text(stmt, 9));
-			res->arr[i].subject = strdup((char *) sqlite3_column_text(stmt, 10));
-			res->arr[i].comment = strdup((char *) sqlite3_column_text(stmt, 11));
+			capacity *= 2;
+			res->arr = (struct post *) realloc(res->arr, sizeof(struct post) * capacity);
 		}
-		sqlite3_finalize(stmt);
+		db_post_row(stmt, &res->arr[res->count++]);
+	}
+	sqlite3_reset(stmt);
+	if (!res->count)
+	{
+		free(res->arr);
+		res->arr = NULL;
 	}
 	return res->count;
 }
@@ -579,8 +1051,45 @@ void db_resource_free(struct resource *res)
 			if (res->arr[i].subject)
 				free(res->arr[i].subject);
 			free(res->arr[i].comment);
+			if (res->arr[i].rendered)
+				free(res->arr[i].rendered);
 		}
 		free(res->arr);
 	}
 	res->count = 0;
 }
+
+long db_backlink_fetch(sqlite3 *db, struct backlinks *bl, enum statement id, ...)
+{
+	/* fetch backlinks of the posts a statement selects
+	 * returns number of items fetched
+	 */
+	va_list args;
+	va_start(args, id);
+	sqlite3_stmt *stmt = db_vstatement(db, id, args);
+	va_end(args);
+	unsigned capacity = 0;
+	bl->count = 0;
+	bl->arr = NULL;
+	while (stmt && sqlite3_step(stmt) == SQLITE_ROW)
+	{
+		if (bl->count == capacity) /* grow */
+		{
+			capacity = (!capacity) ? 16 : capacity * 2;
+			bl->arr = (struct backlink *) realloc(bl->arr, sizeof(struct backlink) * capacity);
+		}
+		struct backlink *b = &bl->arr[bl->count++];
+		b->post_id = sqlite3_column_int64(stmt, 0);
+		b->from_parent = sqlite3_column_int64(stmt, 1);
+		b->from_id = sqlite3_column_int64(stmt, 2);
+	}
+	sqlite3_reset(stmt);
+	return bl->count;
+}
+
+void db_backlink_free(struct backlinks *bl)
+{
+	free(bl->arr);
+	bl->arr = NULL;
+	bl->count = 0;
+}
@@ -0,0 +1,74 @@
+#include <stdlib.h>
+#include <string.h>
+#include "dump.h"
+
+/*
+ * dump.c
+ * field escaping for akari-dump and akari-restore
+ */
+
+size_t dump_escape(char *dest, const char *src)
+{
+	/* write src to dest as a tab-prefixed field
+	 * dest must fit strlen(src) * 2 + 4 bytes
+	 * returns length written
+	 */
+	size_t j = 0;
+	dest[j++] = '\t';
+	if (!src)
+	{
+		dest[j++] = '\\';
+		dest[j++] = 'N';
+	}
+	else for (; *src; src++)
+	{
+		switch (*src)
+		{
+			case '\\': dest[j++] = '\\'; dest[j++] = '\\'; break;
+			case '\t': dest[j++] = '\\'; dest[j++] = 't'; break;
+			case '\n': dest[j++] = '\\'; dest[j++] = 'n'; break;
+			case '\r': dest[j++] = '\\'; dest[j++] = 'r'; break;
+			default: dest[j++] = *src;
+		}
+	}
+	dest[j] = '\0';
+	return j;
+}
+
+unsigned dump_split(char *line, char **field, unsigned n)
+{
+	/* split a record into at most n fields in place, unescaping them
+	 * fields written as \N are returned as NULL
+	 * returns number of fields, or n + 1 if there were too many
+	 */
+	unsigned count = 0;
+	char *from = line, *to = line;
+	while (count <= n)
+	{
+		char *start = to;
+		int null = (from[0] == '\\' && from[1] == 'N'
+		            && (!from[2] || from[2] == '\t' || from[2] == '\n'));
+		if (null)
+			from += 2;
+		for (; *from && *from != '\t' && *from != '\n'; from++)
+		{
+			if (*from != '\\' || !from[1])
+				*to++ = *from;
+			else switch (*++from)
+			{
+				case 't': *to++ = '\t'; break;
+				case 'n': *to++ = '\n'; break;
+				case 'r': *to++ = '\r'; break;
+				default: *to++ = *from; break; /* \\ */
+			}
+		}
+		char end = *from++;
+		*to++ = '\0';
+		if (count < n)
+			field[count] = (null) ? NULL : start;
+		count++;
+		if (end != '\t')
+			break;
+	}
+	return count;
+}
@@ -0,0 +1,482 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+#include "global.h"
+#include "database.h"
+#include "markup.h"
+#include "utf8.h"
+#include "macros.h"
+
+/*
+ * markup.c
+ * comment markup, quotes, linkquotes and [tags]
+ */
+
+#define BOARD_ID_MAX 32 /* longest board id in a cross-board linkquote */
+
+static unsigned linkquote_parse(const char *str, char *board, long *id)
+{
+	/* match an escaped linkquote at the start of str
+	 * '>>N' quotes a post on the same board, board is set empty
+	 * '>>>/board/N' quotes a post on any board
+	 * post number cannot begin with a leading zero
+	 * returns length of the match, 0 if none
+	 */
+	const char *gt = escape('>');
+	unsigned len = strlen(gt), i = len * 2, n = 0;
+	*board = '\0';
+	if (strncmp(str, gt, len) || strncmp(&str[len], gt, len))
+		return 0;
+	if (!strncmp(&str[i], gt, len) && str[i + len] == '/')
+	{
+		for (i += len + 1; n < BOARD_ID_MAX - 1; n++, i++)
+		{
+			char c = str[i];
+			if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')))
+				break;
+			board[n] = c;
+		}
+		board[n] = '\0';
+		if (!n || str[i++] != '/')
+			return 0;
+	}
+	if (str[i] < '1' || str[i] > '9')
+		return 0;
+	for (*id = 0, n = 0; str[i] >= '0' && str[i] <= '9' && n < 18; n++) /* fits in 64 bits */
+		*id = (*id * 10) + (str[i++] - '0');
+	return i;
+}
+
+static int linkquote_cmp(const void *a, const void *b)
+{
+	/* order by board, then post number */
+	const struct linkquote *x = (const struct linkquote *) a;
+	const struct linkquote *y = (const struct linkquote *) b;
+	int cmp = strcmp(x->board_id, y->board_id);
+	return (cmp) ? cmp : (x->id > y->id) - (x->id < y->id);
+}
+
+static const struct linkquote *linkquote_find(const struct quotelist *ql, const char *board_id, long id)
+{
+	/* returns resolved linkquote, NULL if not collected */
+	struct linkquote key;
+	key.board_id = (char *) board_id;
+	key.id = id;
+	if (!ql || !ql->count)
+		return NULL;
+	return (const struct linkquote *) bsearch(&key, ql->arr, ql->count, sizeof(*ql->arr), linkquote_cmp);
+}
+
+unsigned markup_quotes(struct quotelist *ql, const char *comment, const char *board_id)
+{
+	/* collect every linkquote of a sanitized comment posted to board_id,
+	 * seeking the same way enquote_comment() does
+	 * returns number of linkquotes added, duplicates are removed
+	 * later by markup_resolve()
+	 */
+	const char *gt = escape('>');
+	unsigned len = strlen(gt), n, added = 0;
+	char board[BOARD_ID_MAX];
+	long id;
+	const char *seek = comment;
+	while ((seek = strstr(seek, gt)))
+	{
+		if (strncmp(&seek[len], gt, len)) /* '>' quote */
+		{
+			seek += len;
+			continue;
+		}
+		if (!(n = linkquote_parse(seek, board, &id)))
+		{
+			seek += len * 2;
+			continue;
+		}
+		if (ql->count == ql->capacity) /* grow */
+		{
+			ql->capacity = (!ql->capacity) ? 16 : ql->capacity * 2;
+			ql->arr = (struct linkquote *) realloc(ql->arr, sizeof(*ql->arr) * ql->capacity);
+		}
+		struct linkquote *lq = &ql->arr[ql->count++];
+		lq->board_id = strdup((*board) ? board : board_id);
+		lq->id = id;
+		lq->parent_id = 0;
+		seek += n;
+		added++;
+	}
+	return added;
+}
+
+int markup_resolve(sqlite3 *db, struct quotelist *ql)
+{
+	/* sort and deduplicate collected linkquotes, then find the thread
+	 * of every quoted post with a single query
+	 * posts that don't exist keep a parent_id of 0
+	 * returns error code
+	 */
+	if (!ql->count)
+		return 0;
+	unsigned i, j = 0;
+	qsort(ql->arr, ql->count, sizeof(*ql->arr), linkquote_cmp);
+	for (i = 1; i < ql->count; i++)
+	{
+		if (linkquote_cmp(&ql->arr[j], &ql->arr[i]))
+			ql->arr[++j] = ql->arr[i];
+		else
+			free(ql->arr[i].board_id);
+	}
+	ql->count = j + 1;
+
+	/* posts to look up, as a JSON array of [board_id, id] pairs */
+	size_t size = 3, len = 0;
+	for (i = 0; i < ql->count; i++)
+		size += strlen(ql->arr[i].board_id) + 26;
+	char *json = (char *) malloc(size);
+	json[len++] = '[';
+	for (i = 0; i < ql->count; i++)
+		len += sprintf(&json[len], "%s[\"%s\",%ld]", (!i) ? "" : ",",
+		               ql->arr[i].board_id, ql->arr[i].id);
+	sprintf(&json[len], "]");
+
+	int err;
+	sqlite3_stmt *stmt = db_statement(db, SQL_RESOLVE_QUOTES, json);
+	if (!stmt)
+		err = sqlite3_errcode(db);
+	else
+	{
+		while ((err = sqlite3_step(stmt)) == SQLITE_ROW)
+		{
+			struct linkquote *lq = (struct linkquote *) linkquote_find(ql,
+				(const char *) sqlite3_column_text(stmt, 0), sqlite3_column_int64(stmt, 1));
+			if (lq)
+				lq->parent_id = sqlite3_column_int64(stmt, 2);
+		}
+		sqlite3_reset(stmt);
+		err = (err == SQLITE_DONE) ? 0 : err;
+	}
+	free(json);
+	return err;
+}
+
+void markup_quotes_free(struct quotelist *ql)
+{
+	unsigned i;
+	for (i = 0; i < ql->count; i++)
+		free(ql->arr[i].board_id);
+	free(ql->arr);
+	ql->arr = NULL;
+	ql->count = ql->capacity = 0;
+}
+
+int markup_store_quotes(sqlite3 *db, const struct quotelist *ql, const char *comment,
+                        const char *board_id, const long id, const long parent_id)
+{
+	/* record backlinks of a post, every existing post on the same board
+	 * it quotes, linkquotes are looked up in ql, see markup_resolve()
+	 * should be called between db_begin() and db_commit()
+	 * returns error code
+	 */
+	struct quotelist own = { 0 };
+	int err = 0;
+	unsigned i;
+	markup_quotes(&own, comment, board_id);
+	for (i = 0; i < own.count && !err; i++)
+	{
+		const struct linkquote *lq = linkquote_find(ql, own.arr[i].board_id, own.arr[i].id);
+		if (lq && lq->parent_id && lq->id != id && !strcmp(lq->board_id, board_id))
+			err = db_transaction(db, SQL_INSERT_QUOTE, board_id, lq->parent_id, lq->id, parent_id, id);
+	}
+	markup_quotes_free(&own);
+	return err;
+}
+
+static char *emit(char *dest, size_t *len, size_t *size, const char *src, size_t n)
+{
+	/* append n bytes of src to dest, growing it if needed
+	 * returns dest, which may have moved
+	 */
+	if (*len + n + 1 > *size)
+	{
+		*size = (*len + n + 1) * 2;
+		dest = (char *) realloc(dest, *size);
+	}
+	memcpy(&dest[*len], src, n);
+	*len += n;
+	dest[*len] = '\0';
+	return dest;
+}
+
+char *enquote_comment(char **loc, const char *board_id, const long parent_id, const struct quotelist *ql)
+{
+	/* rewrite string with quote markup
+	 * linkquotes are looked up in ql, see markup_resolve()
+	 * - quotes within the thread are previewed by 'popup(self, request, hover)'
+	 * - quotes of other threads link to the thread
+	 * - quotes of posts that don't exist are struck out
+	 * the comment is read once, front to back, and text between markup
+	 * is copied over in runs
+	 */
+	const char *gt = escape('>'), *nl = escape('\n'); /* escape codes */
+	static const char *const quote[] = {
+		"<span class=\"quote\">", "</span>"
+	};
+	static const char *const linkquote[] = {
+		/* same thread */
+		"<a class=\"linkquote\" href=\"#p%ld\" "
+		"onMouseOver=\"popup(this,'p%ld',1)\" "
+		"onMouseOut=\"popup(this,'p%ld',0)\" "
+		"onClick=\"popup(this,'p%ld',0)\">",
+		/* another thread, previewed if it's on the same page */
+		"<a class=\"linkquote\" href=\"%s?board=%s&thread=%ld#p%ld\" "
+		"onMouseOver=\"popup(this,'p%ld',1)\" "
+		"onMouseOut=\"popup(this,'p%ld',0)\">",
+		/* another board */
+		"<a class=\"linkquote\" href=\"%s?board=%s&thread=%ld#p%ld\">",
+		"</a>",
+		/* dead link */
+		"<span class=\"linkquote invalid\">", "</span>"
+	};
+	const char *src = *loc;
+	if (!strstr(src, gt)) /* no '>' found */
+		return *loc;
+	size_t gt_len = strlen(gt), nl_len = strlen(nl), src_len = strlen(src);
+	size_t size = src_len + (src_len / 2) + 256, len = 0; /* grown if markup doesn't fit */
+	size_t i = 0, run = 0; /* run is the start of text not yet copied */
+	char *dest = (char *) malloc(size);
+	int quoted = 0; /* inside a '>' quote until the next newline */
+	const char *seek;
+	/* both escape codes start with '&' */
+	while ((seek = strchr(&src[i], '&')))
+	{
+		i = seek - src;
+		if (quoted && !strncmp(seek, nl, nl_len)) /* end of '>' quote */
+		{
+			dest = emit(dest, &len, &size, &src[run], i - run);
+			dest = emit(dest, &len, &size, quote[1], strlen(quote[1]));
+			run = i;
+			quoted = 0;
+			i += nl_len;
+		}
+		else if (strncmp(seek, gt, gt_len))
+			i++;
+		else if (src_len < i + max(gt_len, nl_len)) /* bounds check */
+			break;
+		/* '>>' linkquote */
+		else if (!strncmp(&src[i + gt_len], gt, gt_len))
+		{
+			char board[BOARD_ID_MAX];
+			long id;
+			unsigned n = linkquote_parse(&src[i], board, &id);
+			if (n)
+			{
+				const struct linkquote *lq = linkquote_find(ql, (*board) ? board : board_id, id);
+				const char *close = linkquote[3];
+				char tag[BOARD_ID_MAX + 400]; /* tag buffer */
+				if (!lq || !lq->parent_id) /* dead */
+				{
+					sprintf(tag, "%s", linkquote[4]);
+					close = linkquote[5];
+				}
+				else if (strcmp(lq->board_id, board_id))
+					sprintf(tag, linkquote[2], BOARD_SCRIPT, lq->board_id, lq->parent_id, id);
+				else if (lq->parent_id != parent_id)
+					sprintf(tag, linkquote[1], BOARD_SCRIPT, lq->board_id, lq->parent_id, id, id, id);
+				else
+					sprintf(tag, linkquote[0], id, id, id, id);
+				dest = emit(dest, &len, &size, &src[run], i - run);
+				dest = emit(dest, &len, &size, tag, strlen(tag));
+				dest = emit(dest, &len, &size, &src[i], n);
+				dest = emit(dest, &len, &size, close, strlen(close));
+				i += n; /* resume after the link */
+				run = i;
+			}
+			else
+				i += gt_len * 2;
+		}
+		/* '>' quote */
+		else if (!i || (i >= nl_len && !strncmp(&src[i - nl_len], nl, nl_len)))
+		{
+			/* '>' quotes are only valid at the start of a new line
+			 * linkquotes may follow on the same line
+			 */
+			dest = emit(dest, &len, &size, &src[run], i - run);
+			dest = emit(dest, &len, &size, quote[0], strlen(quote[0]));
+			run = i;
+			quoted = 1;
+			i += gt_len;
+		}
+		else
+			i++;
+	}
+	dest = emit(dest, &len, &size, &src[run], src_len - run);
+	if (quoted) /* quote runs to the end */
+		dest = emit(dest, &len, &size, quote[1], strlen(quote[1]));
+	free(*loc);
+	*loc = dest;
+	return dest;
+}
+
+char *format_comment(char **loc)
+{
+	/* replace matching [tags] with corresponding markup in a single pass
+	 * 1. nesting:
+	 *     - nesting of [tags] is fine, left tags are paired with right
+	 *       tags in the order they appear
+	 *     - a right tag with nothing to close is left as is, and so is
+	 *       every later tag of its kind
+	 * 2. auto-complete:
+	 *     - implicit [/tag] added to end of string if none found
+	 * 3. verbatim tags, eg. [code]:
+	 *     - nesting of other tags within them is not allowed
+	 *     - whitespace after the left tag and before the right tag is trimmed
+	 */
+	static const struct {
+		const char *markup[2];
+		int verbatim;
+	} tag[] = {
+		[SPOILER_L / 2] = { { "<span class=\"spoiler\">", "</span>" }, 0 },
+		[CODE_L / 2] = { { "<div class=\"codeblock\">", "</div>" }, 1 }
+	};
+	/* some assumptions about the format tag system */
+	static_assert((SUPPORTED_TAGS % 2) == 0); /* tag count must be even */
+	static_assert(static_size(tag) == SUPPORTED_TAGS / 2); /* size check */
+
+	const char *src = *loc;
+	if (!strchr(src, '[')) /* no [tags] found */
+		return *loc;
+	size_t src_len = strlen(src), size = src_len + 256, len = 0;
+	size_t i = 0, run = 0; /* run is the start of text not yet copied */
+	char *dest = (char *) malloc(size);
+	unsigned open[static_size(tag)] = { 0 }; /* left tags awaiting a right tag */
+	int done[static_size(tag)] = { 0 }; /* stray right tag seen */
+	int verbatim = -1; /* tag being read verbatim, -1 if none */
+	const char *seek;
+	while ((seek = strchr(&src[i], '[')))
+	{
+		i = seek - src;
+		unsigned t, n = 0;
+		for (t = 0; t < SUPPORTED_TAGS; t++)
+			if (!strncmp(seek, fmt[t], (n = strlen(fmt[t]))))
+				break;
+		if (t == SUPPORTED_TAGS || (verbatim >= 0 && (unsigned) verbatim != t / 2))
+		{
+			i++;
+			continue;
+		}
+		unsigned k = t / 2;
+		const char *out = fmt[t]; /* left as is unless paired */
+		size_t end = i;
+		if (t % 2 == 0) /* left tag */
+		{
+			if (!done[k])
+			{
+				out = tag[k].markup[0];
+				open[k]++;
+			}
+		}
+		else /* right tag */
+		{
+			if (verbatim >= 0)
+				while (end > run && wspace(src[end - 1]))
+					end--;
+			if (!open[k])
+				done[k] = 1;
+			if (!done[k])
+			{
+				out = tag[k].markup[1];
+				open[k]--;
+			}
+			verbatim = -1;
+		}
+		dest = emit(dest, &len, &size, &src[run], end - run);
+		dest = emit(dest, &len, &size, out, strlen(out));
+		i += n;
+		if (t % 2 == 0 && tag[k].verbatim)
+		{
+			verbatim = k;
+			while (wspace(src[i]))
+				i++;
+		}
+		run = i;
+	}
+	size_t end = src_len;
+	if (verbatim >= 0) /* runs to the end */
+		while (end > run && wspace(src[end - 1]))
+			end--;
+	dest = emit(dest, &len, &size, &src[run], end - run);
+	unsigned k;
+	for (k = 0; k < static_size(tag); k++)
+		while (open[k]--)
+			dest = emit(dest, &len, &size, tag[k].markup[1], strlen(tag[k].markup[1]));
+	free(*loc);
+	*loc = dest;
+	return dest;
+}
+
+char *markup_render(const char *comment, const char *board_id, const long parent_id,
+                    const struct quotelist *ql)
+{
+	/* returns newly allocated HTML for a sanitized comment
+	 * parent_id is the thread it's posted in, 0 for a new thread
+	 */
+	char *str = strdup(comment);
+	if (!str)
+		return NULL;
+	enquote_comment(&str, board_id, parent_id, ql);
+	return format_comment(&str);
+}
+
+int markup_rebuild(sqlite3 *db, const char *board_id, long *cursor, long *count)
+{
+	/* store markup and backlinks of up to RENDER_BATCH stale posts past
+	 * the rowid cursor on one board, or on every board if board_id is NULL
+	 * the whole batch is read before any row is updated, and its
+	 * linkquotes are resolved together
+	 * returns error code
+	 */
+	struct {
+		long rowid;
+		long parent_id;
+		long id;
+		char *board_id;
+		char *comment;
+	} *row = malloc(sizeof(*row) * RENDER_BATCH);
+	struct quotelist ql = { 0 };
+	sqlite3_stmt *stmt = db_statement(db, SQL_STALE_MARKUP, *cursor,
+	                                  (long) MARKUP_VER, (long) RENDER_BATCH, board_id);
+	int err = (!stmt) ? sqlite3_errcode(db) : 0;
+	long i;
+	*count = 0;
+	while (stmt && (err = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		row[*count].rowid = sqlite3_column_int64(stmt, 0);
+		row[*count].board_id = strdup((const char *) sqlite3_column_text(stmt, 1));
+		row[*count].parent_id = sqlite3_column_int64(stmt, 2);
+		row[*count].id = sqlite3_column_int64(stmt, 3);
+		row[*count].comment = strdup((const char *) sqlite3_column_text(stmt, 4));
+		markup_quotes(&ql, row[*count].comment, row[*count].board_id);
+		(*count)++;
+	}
+	sqlite3_reset(stmt);
+	if (err == SQLITE_DONE)
+		err = markup_resolve(db, &ql);
+	for (i = 0; i < *count; i++)
+	{
+		if (!err)
+		{
+			char *markup = markup_render(row[i].comment, row[i].board_id, row[i].parent_id, &ql);
+			err = db_transaction(db, SQL_UPDATE_MARKUP, markup, (long) MARKUP_VER, row[i].rowid);
+			free(markup);
+			if (!err)
+				err = markup_store_quotes(db, &ql, row[i].comment, row[i].board_id,
+				                          row[i].id, row[i].parent_id);
+		}
+		free(row[i].board_id);
+		free(row[i].comment);
+	}
+	if (*count)
+		*cursor = row[*count - 1].rowid;
+	markup_quotes_free(&ql);
+	free(row);
+	return err;
+}
@@ -0,0 +1,119 @@
+#define _POSIX_C_SOURCE 200809L /* mmap, ftruncate, pwrite */
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "global.h"
+#include "ratelimit.h"
+#include "macros.h"
+
+/*
+ * ratelimit.c
+ * lock-free post cooldown shared between submit processes
+ */
+
+#ifdef NDEBUG
+
+/* each slot packs a 32-bit IP hash and a 32-bit post time into
+ * one word, so a slot is always read and replaced as a whole
+ * slots past COOLDOWN_SEC are free to be reused, no cleanup needed
+ */
+struct table {
+	int64_t overflow; /* misses are unreliable until this time */
+	uint64_t slot[RATELIMIT_SLOTS];
+};
+static_assert(!(RATELIMIT_SLOTS & (RATELIMIT_SLOTS - 1))); /* power of 2 */
+
+static struct table *table = NULL; /* mapped once per process */
+
+static struct table *ratelimit_map(void)
+{
+	/* map shared table, creating the file on first use
+	 * a new or grown table knows nothing of posts made before it,
+	 * it's flagged as overflowed for COOLDOWN_SEC before being sized
+	 * so no process can trust a miss in it until then
+	 * returns NULL if unavailable
+	 */
+	if (table)
+		return table;
+	const off_t size = sizeof(struct table);
+	const int64_t overflow = (int64_t) time(NULL) + COOLDOWN_SEC;
+	struct stat st;
+	int fd = open(RATELIMIT_LOC, O_RDWR | O_CREAT, 0600);
+	if (fd < 0)
+		return NULL;
+	if (!fstat(fd, &st) && (st.st_size >= size ||
+	    (pwrite(fd, &overflow, sizeof(overflow), offsetof(struct table, overflow)) == sizeof(overflow)
+	     && !ftruncate(fd, size))))
+	{
+		void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (p != MAP_FAILED)
+			table = (struct table *) p;
+	}
+	close(fd); /* mapping stays valid */
+	return table;
+}
+
+static uint32_t ip_hash(const char *ip_addr)
+{
+	/* 32-bit FNV-1a, never 0 so that 0 marks an empty slot */
+	uint32_t h = 2166136261u;
+	while (ip_addr && *ip_addr)
+	{
+		h ^= (unsigned char) *ip_addr++;
+		h *= 16777619u;
+	}
+	return (!h) ? 1 : h;
+}
+
+long ratelimit_cooldown(const char *ip_addr, long now)
+{
+	/* returns seconds left before ip_addr may post again
+	 * returns -1 if unknown, caller should ask the database
+	 */
+	struct table *t = ratelimit_map();
+	if (!t)
+		return -1;
+	const uint32_t key = ip_hash(ip_addr);
+	uint32_t elapsed = UINT32_MAX;
+	unsigned i;
+	for (i = 0; i < RATELIMIT_PROBES; i++)
+	{
+		uint64_t s = __atomic_load_n(&t->slot[(key + i) & (RATELIMIT_SLOTS - 1)], __ATOMIC_ACQUIRE);
+		if (s && (uint32_t) (s >> 32) == key && (uint32_t) now - (uint32_t) s < elapsed)
+			elapsed = (uint32_t) now - (uint32_t) s; /* most recent */
+	}
+	if (elapsed < COOLDOWN_SEC)
+		return COOLDOWN_SEC - elapsed;
+	if (now < __atomic_load_n(&t->overflow, __ATOMIC_ACQUIRE))
+		return -1; /* table was recently full, a post may have been dropped */
+	return 0;
+}
+
+void ratelimit_record(const char *ip_addr, long now)
+{
+	/* remember post time of ip_addr
+	 * claims the first slot that is empty, expired or already ours
+	 * if every slot in reach is taken, flag the table as overflowed
+	 */
+	struct table *t = ratelimit_map();
+	if (!t)
+		return;
+	const uint32_t key = ip_hash(ip_addr);
+	const uint64_t entry = (uint64_t) key << 32 | (uint32_t) now;
+	unsigned i;
+	for (i = 0; i < RATELIMIT_PROBES; i++)
+	{
+		uint64_t *slot = &t->slot[(key + i) & (RATELIMIT_SLOTS - 1)];
+		uint64_t s = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+		if (!s || (uint32_t) (s >> 32) == key || (uint32_t) now - (uint32_t) s >= COOLDOWN_SEC)
+			if (__atomic_compare_exchange_n(slot, &s, entry, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+				return;
+	}
+	__atomic_store_n(&t->overflow, (int64_t) now + COOLDOWN_SEC, __ATOMIC_RELEASE);
+}
+
+#endif
@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sqlite3.h>
+#include "global.h"
+#include "database.h"
+#include "query.h"
+#include "utf8.h"
+#include "macros.h"
+
+/*
+ * [core functionality]
+ * search.c
+ * full-text post search
+ */
+
+/* USAGE:
+ * search all boards: q=hello+world
+ * search one board:  q=hello+world&board=a&page=2
+ * every word must appear in a matching post, results are ranked by BM25
+ * among the newest SEARCH_MAX_MATCHES matching posts
+ */
+
+static const char *const html[] = {
+	/* header */
+	"<!DOCTYPE html>"
+	"<html lang=\"en-US\">"
+	"<head>"
+		"<title>Search - %s</title>"
+		"<meta charset=\"UTF-8\" />"
+		"<meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\" />"
+		"<meta name=\"theme-color\" content=\"#DC8B9A\" />"
+		"<link rel=\"shortcut icon\" type=\"image/x-icon\" href=\"/img/favicon.ico\" />"
+		"<link rel=\"stylesheet\" type=\"text/css\" href=\"/css/style.css\" />"
+	"</head>"
+	"<body>"
+		"<div id=\"boardtitle\"><b>Search</b> - %s</div>",
+	/* footer */
+		"<br/>"
+		"<div class=\"footer\" style=\"text-align:center;\">"
+			"Powered by %s rev.%d/db-%d %s"
+		"</div>"
+	"</body>"
+	"</html>"
+};
+
+struct parameters {
+	char *terms; /* as typed, for the query and pagination links */
+	char *match; /* sanitized, for the search box */
+	const char *board_id; /* NULL searches all boards */
+	long page_no;
+};
+
+static void url_encode(const char *str)
+{
+	/* print string as a GET query value */
+	for (; *str; str++)
+	{
+		unsigned char c = *str;
+		if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+		    || c == '-' || c == '_' || c == '.' || c == '~')
+			fputc(c, stdout);
+		else
+			fprintf(stdout, "%%%02X", c);
+	}
+}
+
+static unsigned fts_string(char *dest, const char *src, unsigned n)
+{
+	/* copy n bytes of src to dest as a quoted FTS5 string
+	 * returns length written, dest must fit n * 2 + 2 bytes
+	 */
+	unsigned i, j = 0;
+	dest[j++] = '\"';
+	for (i = 0; i < n; i++)
+	{
+		if (src[i] == '\"') /* escaped by doubling */
+			dest[j++] = '\"';
+		dest[j++] = src[i];
+	}
+	dest[j++] = '\"';
+	return j;
+}
+
+static char *search_expression(const char *match)
+{
+	/* build an FTS5 query from search terms
+	 * every whitespace-separated word is quoted so user input can't be
+	 * parsed as query syntax, words are only matched against subject and
+	 * comment, boards are filtered by SQL_SEARCH
+	 * eg. {subject comment} : ("hello" """world")
+	 * returns NULL if there's nothing to search for
+	 */
+	static const char *const expr[] = {
+		"{subject comment} : (", ")"
+	};
+	unsigned size = strlen(match) * 3 + 64;
+	char *dest = (char *) malloc(size);
+	unsigned i = 0, j = 0, words = 0;
+	j += sprintf(&dest[j], "%s", expr[0]);
+	while (match[i])
+	{
+		unsigned len = 0;
+		while (wspace(match[i]))
+			i++;
+		while (match[i + len] && !wspace(match[i + len]))
+			len++;
+		if (!len)
+			break;
+		if (words++)
+			dest[j++] = ' ';
+		j += fts_string(&dest[j], &match[i], len);
+		i += len;
+	}
+	sprintf(&dest[j], "%s", expr[1]);
+	if (!words)
+	{
+		free(dest);
+		dest = NULL;
+	}
+	return dest;
+}
+
+static void display_searchform(const struct board *list, const struct parameters *params)
+{
+	/* search box and board filter */
+	static const char *const form[] = {
+		"<div id=\"postbox\">"
+		"<form action=\"%s\" method=\"get\">"
+			"<input class=\"field\" type=\"text\" name=\"q\" maxlength=\"%d\" value=\"%s\"> ",
+			"<select name=\"board\">"
+				"<option value=\"\">All boards</option>",
+				"<option value=\"%s\"%s>/%s/ - %s</option>",
+			"</select> "
+			"<input type=\"submit\" value=\"Search\">"
+		"</form>"
+		"</div>"
+		"<div class=\"navi controls center\">[<a href=\"/\">Home</a>]</div>"
+		"<div class=\"line\"></div>"
+	};
+	unsigned i;
+	fprintf(stdout, form[0], SEARCH_SCRIPT, SEARCH_MAX_LENGTH,
+	        (!params->match) ? "" : params->match);
+	fprintf(stdout, form[1]);
+	for (i = 0; i < list->count; i++)
+	{
+		struct entry *board = &list->arr[i];
+		const char *sel = (params->board_id == board->id) ? " selected" : "";
+		fprintf(stdout, form[2], board->id, sel, board->id, board->name);
+	}
+	fprintf(stdout, form[3]);
+}
+
+static void display_page_link(const struct parameters *params, long page, const char *label)
+{
+	/* link to another page of the same search */
+	fprintf(stdout, "[<a href=\"%s?q=", SEARCH_SCRIPT);
+	url_encode(params->terms);
+	if (params->board_id)
+		fprintf(stdout, "&board=%s", params->board_id);
+	if (page)
+		fprintf(stdout, "&page=%ld", page + 1);
+	fprintf(stdout, "\">%s</a>] ", label);
+}
+
+static void display_match(const char *str)
+{
+	/* print highlight() or snippet() output, the index holds unescaped
+	 * text so it's escaped here, terms wrapped in \x01 and \x02 are bold
+	 */
+	for (; *str; str++)
+	{
+		if (*str == '\x01')
+			fprintf(stdout, "<b>");
+		else if (*str == '\x02')
+			fprintf(stdout, "</b>");
+		else if (escape(*str))
+			fprintf(stdout, "%s", escape(*str));
+		else
+			fputc(*str, stdout);
+	}
+}
+
+static void display_results(sqlite3 *db, const struct parameters *params)
+{
+	/* one page of ranked results, each linking back to its thread
+	 * one row past the page tells if there is a next page
+	 */
+	static const char *const result[] = {
+		"<div class=\"pContainer\">"
+			"<span class=\"navi controls\">"
+				"[<a href=\"%s?board=%s\">/%s/</a>] "
+			"</span>",
+			"<span class=\"pSubject\">", "</span> ",
+			"<span class=\"pDate\">%s</span> "
+			"<span class=\"pId\"><a href=\"%s?board=%s&thread=%ld#p%ld\">No.%ld</a></span>"
+			"<div class=\"pComment\">",
+			"</div>"
+		"</div><br/>"
+	};
+	char *expr = search_expression(params->terms);
+	if (!expr)
+		return;
+	unsigned count = 0;
+	long offset = params->page_no * SEARCH_PER_PAGE;
+	sqlite3_stmt *stmt = db_statement(db, SQL_SEARCH, expr, (long) SEARCH_PER_PAGE + 1,
+	                                  offset, (long) SEARCH_MAX_MATCHES, params->board_id);
+	int err = (!stmt) ? sqlite3_errcode(db) : 0;
+	while (stmt && (err = sqlite3_step(stmt)) == SQLITE_ROW && count++ < SEARCH_PER_PAGE)
+	{
+		const char *board_id = (const char *) sqlite3_column_text(stmt, 0);
+		long parent_id = sqlite3_column_int64(stmt, 1);
+		long id = sqlite3_column_int64(stmt, 2);
+		time_t post_time = sqlite3_column_int64(stmt, 3);
+		const char *subject = (const char *) sqlite3_column_text(stmt, 4);
+		const char *comment = (const char *) sqlite3_column_text(stmt, 5);
+
+		char time_str[100]; /* human readable date */
+		strftime(time_str, 100, "%a, %m/%d/%y %I:%M:%S %p", localtime(&post_time));
+		fprintf(stdout, result[0], BOARD_SCRIPT, board_id, board_id);
+		if (subject)
+		{
+			fprintf(stdout, result[1]);
+			display_match(subject);
+			fprintf(stdout, result[2]);
+		}
+		fprintf(stdout, result[3], time_str, BOARD_SCRIPT, board_id, parent_id, id, id);
+		if (comment)
+			display_match(comment);
+		fprintf(stdout, result[4]);
+	}
+	if (err == SQLITE_ROW || err == SQLITE_DONE)
+		err = 0;
+	sqlite3_reset(stmt);
+	free(expr);
+
+	if (err)
+		fprintf(stdout, "<h2>Search failed. (e%d: %s)</h2>", err, sqlite3_err[err]);
+	else if (!count)
+		fprintf(stdout, "<h2>No posts matched your search.</h2>");
+	fprintf(stdout, "<div class=\"navi controls center\">");
+	if (params->page_no > 0)
+		display_page_link(params, params->page_no - 1, "&lt;&lt;");
+	if (count || params->page_no > 0)
+		fprintf(stdout, "Page %ld ", params->page_no + 1);
+	if (count > SEARCH_PER_PAGE)
+		display_page_link(params, params->page_no + 1, "&gt;&gt;");
+	fprintf(stdout, "</div>");
+}
+
+static void search_request(sqlite3 *db, const struct board *list)
+{
+	/* serve a single request
+	 * search terms are decoded like submitted comments, the index
+	 * holds unescaped text so they're searched for as typed
+	 */
+	clock_t start = clock();
+	struct parameters params = { 0 };
+	char *query_str = strdup(getenv_s("QUERY_STRING"));
+	query_t query = { 0 };
+	if (query_str)
+	{
+		query_parse(&query, query_str);
+		free(query_str);
+		const char *q = query_search(&query, "q"),
+		           *board = query_search(&query, "board"),
+		           *page = query_search(&query, "page");
+		unsigned i;
+		if (board)
+		{
+			for (i = 0; i < list->count && !params.board_id; i++)
+				if (!strcmp(list->arr[i].id, board)) /* validate board */
+					params.board_id = list->arr[i].id;
+		}
+		params.page_no = atoi_s(page);
+		if (params.page_no > 0) /* pages 0-indexed internally */
+			params.page_no -= 1;
+		if ((params.terms = strdup(q)))
+		{
+			utf8_rewrite(params.terms); /* whitespace is left to search_expression() */
+			if (utf8_charcount(params.terms) <= SEARCH_MAX_LENGTH
+			    && (params.match = strdup(params.terms)))
+				xss_sanitize(&params.match);
+		}
+	}
+
+	fprintf(stdout, "Content-type: text/html\n");
+	fprintf(stdout, "Status: 200 OK\n\n");
+	fprintf(stdout, html[0], IDENT_FULL, IDENT_FULL);
+	display_searchform(list, &params);
+	if (params.terms && !params.match)
+		fprintf(stdout, "<h2>Search terms are limited to %d characters.</h2>", SEARCH_MAX_LENGTH);
+	else if (params.match)
+		display_results(db, &params);
+
+	float delta = ((float) (clock() - start) / CLOCKS_PER_SEC) * 1000;
+	char pageload[100];
+	sprintf(pageload, "-- completed in %.3fms.", delta);
+	fprintf(stdout, html[1], IDENT, REVISION, DB_VER, (!delta) ? "" : pageload);
+	fflush(stdout);
+
+	free(params.terms);
+	free(params.match);
+	query_free(&query);
+}
+
+int main(void)
+{
+	/* database handle and board list persist across requests
+	 * when built for FastCGI, see request_loop()
+	 */
+	int err;
+	sqlite3 *db;
+	if ((err = db_open(&db, SQLITE_OPEN_READONLY)))
+	{
+		fprintf(stdout, "Cannot open database. (e%d: %s)", err, sqlite3_err[err]);
+		return 1;
+	}
+	struct board list = { 0 };
+	unsigned served;
+	request_loop(served)
+	{
+		if (list.count || db_board_fetch(db, &list))
+			search_request(db, &list);
+		else
+			fprintf(stdout, "Content-type: text/plain\n\nCannot fetch boards.");
+		db_lock_report("search");
+	}
+	db_board_free(&list);
+	db_close(db);
+	return 0;
+}
@@ -3,18 +3,20 @@
 #include <string.h>
 #include <stdarg.h>
 #include <time.h>
-#include <unistd.h>
+#include <setjmp.h>
 #include <sqlite3.h>
 #include "global.h"
 #include "database.h"
 #include "query.h"
 #include "utf8.h"
+#include "markup.h"
+#include "ratelimit.h"
 #include "macros.h"
 
 /*
  * [core functionality]
  * submit.c
- * POST submission, database insert, housekeeping
+ * POST submission, database insert
  */
 
 /* USAGE:
@@ -47,10 +49,21 @@ static const char *const html[] = {
 	"<div class=\"navi controls\">[<a href=\"%s\">Go back</a>]</div>"
 };
 
+/* per-request state
+ * abort_now() unwinds back to the request loop, where everything
+ * below is released by request_reset() before the next request
+ */
+enum input_field { BOARD_ID, NAME, SUBJECT, COMMENT, INPUT_FIELDS };
+static jmp_buf request_end;
+static query_t query;
+static char *input[INPUT_FIELDS]; /* sanitized copies of user input */
+static char *rendered; /* comment markup */
+static struct quotelist quotes; /* linkquotes of the comment */
+
 static void abort_now(const char *fmt, ...)
 {
 	/* exception handling
-	 * print formatted error, add backlink and exit
+	 * print formatted error, add backlink and end the request
 	 */
 	va_list args;
 	va_start(args, fmt);
@@ -58,24 +71,51 @@ static void abort_now(const char *fmt, ...)
 	va_end(args);
 	const char *refer = getenv_s("HTTP_REFERER");
 	fprintf(stdout, html[2], (!refer) ? "/" : refer);
-	fprintf(stdout, html[1]); /* footer */
-	exit(1);
+	longjmp(request_end, 1);
 }
 
-int main(void)
+static void request_reset(sqlite3 *db)
 {
+	/* release per-request state
+	 * a transaction left open by an aborted request is rolled back
+	 */
+	if (db)
+		db_rollback(db);
+	unsigned i;
+	for (i = 0; i < INPUT_FIELDS; i++)
+	{
+		free((!input[i]) ? NULL : input[i]);
+		input[i] = NULL;
+	}
+	free(rendered);
+	rendered = NULL;
+	markup_quotes_free(&quotes);
+	query_free(&query);
+}
+
+static void submit_request(sqlite3 **dbp, struct board *list)
+{
+	/* serve a single POST submission
+	 * database connection and board list are fetched on first use
+	 * and kept, a failed fetch is retried by the next request
+	 */
 	int err;
 	FILE *fp;
-	sqlite3 *db;
-	fprintf(stdout, "Content-type: text/html\n\n");
-	fprintf(stdout, html[0], IDENT_FULL, IDENT, REVISION, DB_VER);
 	if ((fp = fopen("POSTING_DISABLED", "r"))) /* maintenance lockout */
+	{
+		fclose(fp);
 		abort_now("<h2>Posting disabled, check back later.</h2>");
-	if ((err = sqlite3_open_v2(DATABASE_LOC, &db, 2, NULL))) /* read/write mode */
+	}
+	if (!*dbp && (err = db_open(dbp, SQLITE_OPEN_READWRITE)))
 		abort_now("<h2>Cannot open database. (e%d: %s)</h2>", err, sqlite3_err[err]);
+	sqlite3 *db = *dbp;
+	if (!list->count && !db_board_fetch(db, list))
+	{
+		err = sqlite3_errcode(db);
+		abort_now("<h2>Cannot fetch boards. (e%d: %s)</h2>", err, sqlite3_err[err]);
+	}
 
-	query_t query = { 0 }; /* obtain POST options */
-	const char *request = getenv_s("REQUEST_METHOD");
+	const char *request = getenv_s("REQUEST_METHOD"); /* obtain POST options */
 	if (!request)
 		abort_now("<h2>Not a valid CGI environment.</h2>");
 	if (!strcmp(request, "POST"))
@@ -97,8 +137,8 @@ int main(void)
 		abort_now("<h2>Expected a POST request.</h2>");
 
 	/* note:
-	 * cm strings stored in query container
-	 * or as static data, do not free them
+	 * cm strings are either static data or point into input[],
+	 * which request_reset() frees, do not free them
 	 */
 	if (query.count > 0)
 	{
@@ -106,24 +146,24 @@ int main(void)
 
 		unsigned timer;
 		cm.ip = getenv_s("REMOTE_ADDR"); /* ip address */
-		if ((timer = db_cooldown_timer(db, cm.ip))) /* post cooldown */
+		long cooldown = ratelimit_cooldown(cm.ip, time(NULL)); /* shared table first */
+		if (cooldown < 0) /* unknown, ask the database */
+			cooldown = db_cooldown_timer(db, cm.ip);
+		if ((timer = cooldown)) /* post cooldown */
 			abort_now("<h2>Please wait %s before posting again.</h2>", time_human(timer));
-		cm.board_id = query_search(&query, "board"); /* get board_id */
-		if (cm.board_id)
+		input[BOARD_ID] = strdup(query_search(&query, "board")); /* get board_id */
+		if (input[BOARD_ID])
 		{
-			strip_whitespace(utf8_rewrite(cm.board_id));
-			xss_sanitize(&cm.board_id); /* scrub */
-			struct board list;
-			db_board_fetch(db, &list);
+			strip_whitespace(utf8_rewrite(input[BOARD_ID]));
+			cm.board_id = xss_sanitize(&input[BOARD_ID]); /* scrub */
 			unsigned i, valid = 0;
-			for (i = 0; i < list.count && !valid; i++)
-				if (!strcmp(list.arr[i].id, cm.board_id)) /* validate board */
+			for (i = 0; i < list->count && !valid; i++)
+				if (!strcmp(list->arr[i].id, cm.board_id)) /* validate board */
 					valid = 1;
 			if (!valid)
 				abort_now("<h2>Specified board doesn't exist.</h2>");
 			if (db_status_flags(db, cm.board_id, -1) & BOARD_LOCKED)
 				abort_now("<h2>Posting is disabled on this board.<h2>");
-			db_board_free(&list);
 		}
 		else
 			abort_now("<h2>No board provided.</h2>");
@@ -144,12 +184,10 @@ int main(void)
 			abort_now("<h2>Invalid submit mode.</h2>");
 
 		cm.time = time(NULL); /* assign timestamp */
-		cm.id = db_total_posts(db, cm.board_id, -1) + 1; /* assign post id */
 		char *parent_str = query_search(&query, "parent");
 		if (mode == THREAD_MODE)
 		{
-			cm.parent_id = cm.id;
-			if (db_user_threads(db, cm.board_id, cm.ip) > MAX_THREADS_PER_IP)
+			if (db_user_threads(db, cm.board_id, cm.ip) >= MAX_THREADS_PER_IP)
 				abort_now("<h2>You can only have %d active threads at a time.</h2>",
 				          MAX_THREADS_PER_IP);
 		}
@@ -179,16 +217,16 @@ int main(void)
 		 * sanitation/character escapes come last as they interfere
 		 * with character count/tripcode passwords
 		 */
-		cm.name = query_search(&query, "name"); /* name and/or tripcode */
-		cm.subject = query_search(&query, "subject"); /* subject */
-		cm.comment = query_search(&query, "comment"); /* comment body */
-		if (!cm.comment)
+		input[NAME] = strdup(query_search(&query, "name")); /* name and/or tripcode */
+		input[SUBJECT] = strdup(query_search(&query, "subject")); /* subject */
+		input[COMMENT] = strdup(query_search(&query, "comment")); /* comment body */
+		if (!input[COMMENT])
 			abort_now("<h2>You cannot post a blank comment.</h2>");
 
 		/* three star pointer needed to assign realloc'd char arrays
-		 * back to their original post container
+		 * back to their owner in input[]
 		 */
-		char **field[] = { &cm.name, &cm.subject, &cm.comment };
+		char **field[] = { &input[NAME], &input[SUBJECT], &input[COMMENT] };
 		static const unsigned limit[] = {
 			NAME_MAX_LENGTH, SUBJECT_MAX_LENGTH, COMMENT_MAX_LENGTH
 		};
@@ -203,46 +241,86 @@ int main(void)
 			}
 		}
 		/* generate tripcode from #password if name provided */
+		cm.name = input[NAME];
 		cm.trip = (!cm.name) ? NULL : tripcode_hash(tripcode_pass(&cm.name));
 
 		for (i = 0; i < static_size(field); i++)
 			if (*field[i]) xss_sanitize(field[i]); /* sanitize inputs */
+		cm.name = (!cm.name) ? NULL : input[NAME]; /* name may have been omitted */
+		cm.subject = input[SUBJECT];
+		cm.comment = input[COMMENT];
 
 		if ((timer = db_duplicate_post(db, cm.comment, cm.ip))) /* flooding */
 			abort_now("<h2>Wait %s before making an identical post.</h2>", time_human(timer));
 		if (spam_filter(cm.comment)) /* spammy behavior */
 			abort_now("<h2>This post is spam. Please rewrite it.</h2>");
 
-		int attempts = 0;
-		reassign: if (attempts++ > 0) /* reattempt insert operation */
+		/* comment markup is rendered once here instead of on every view
+		 * linkquotes are resolved to their threads first
+		 */
+		markup_quotes(&quotes, cm.comment, cm.board_id);
+		if ((err = markup_resolve(db, &quotes)))
+			abort_now("<h2>Post failed. (e%d: %s)</h2>", err, sqlite3_err[err]);
+		cm.rendered = rendered = markup_render(cm.comment, cm.board_id,
+		                                       (mode == REPLY_MODE) ? cm.parent_id : 0, &quotes);
+
+		/* insert, backlinks, bump and archive are committed as a single transaction
+		 * post id's come from the board's post sequence, which is
+		 * only advanced while holding the write lock
+		 * expiry and other housekeeping is left to akari-maint
+		 */
+		if (!(err = db_begin(db)))
 		{
-			sleep(1);
-			cm.time = time(NULL); /* reassign post id's */
-			cm.id = db_total_posts(db, cm.board_id, -1) + 1;
+			if (!(cm.id = db_next_post_id(db, cm.board_id))) /* assign post id */
+				err = sqlite3_errcode(db);
 			if (mode == THREAD_MODE)
 				cm.parent_id = cm.id;
-		}
-		if (!(err = db_post_insert(db, &cm))) /* insert post / push new thread */
-		{
-			db_archive_oldest(db, cm.board_id); /* prune stale threads */
-			if (mode == REPLY_MODE)
+			if (!err && !(err = db_post_insert(db, &cm)) /* insert post / push new thread */
+			    && !(err = markup_store_quotes(db, &quotes, cm.comment, cm.board_id, cm.id, cm.parent_id)))
 			{
-				if (!(cm.options & POST_SAGE)) /* and bump the parent */
-					db_bump_parent(db, cm.board_id, cm.parent_id);
-				fprintf(stdout, "<h2>Reply to Thread No.%ld<br/>", cm.parent_id);
-				fprintf(stdout, ">>> Post No.%ld submitted!</h2>", cm.id);
+				if (mode == REPLY_MODE && !(cm.options & POST_SAGE))
+					db_bump_parent(db, cm.board_id, cm.parent_id); /* and bump the parent */
+				long archived = 0; /* only new threads push others into the archive */
+				if (mode == REPLY_MODE || !(err = db_archive_oldest(db, cm.board_id, &archived)))
+					err = db_commit(db);
 			}
-			else /* THREAD_MODE */
-				fprintf(stdout, "<h2>Thread No.%ld created!</h2>", cm.id);
-			thread_redirect(cm.board_id, cm.parent_id, cm.id); /* redirect */
+			if (err)
+				db_rollback(db);
 		}
-		else if (attempts < INSERT_MAX_RETRIES) /* post number collision? */
-			goto reassign;
-		else
+		if (err)
 			abort_now("<h2>Post failed. (e%d: %s)</h2>", err, sqlite3_err[err]);
-		query_free(&query);
+		ratelimit_record(cm.ip, cm.time); /* start cooldown */
+		if (mode == REPLY_MODE)
+		{
+			fprintf(stdout, "<h2>Reply to Thread No.%ld<br/>", cm.parent_id);
+			fprintf(stdout, ">>> Post No.%ld submitted!</h2>", cm.id);
+		}
+		else /* THREAD_MODE */
+			fprintf(stdout, "<h2>Thread No.%ld created!</h2>", cm.id);
+		thread_redirect(cm.board_id, cm.parent_id, cm.id); /* redirect */
+	}
+}
+
+int main(void)
+{
+	/* database connection and board list persist across requests
+	 * when built for FastCGI, see request_loop()
+	 */
+	static sqlite3 *db = NULL; /* static storage survives longjmp */
+	static struct board list = { 0 };
+	static unsigned served;
+	request_loop(served)
+	{
+		fprintf(stdout, "Content-type: text/html\n\n");
+		fprintf(stdout, html[0], IDENT_FULL, IDENT, REVISION, DB_VER);
+		if (!setjmp(request_end))
+			submit_request(&db, &list);
+		request_reset(db);
+		fprintf(stdout, html[1]); /* footer */
+		fflush(stdout);
+		db_lock_report("submit");
 	}
-	fprintf(stdout, html[1]); /* footer */
-	sqlite3_close(db);
+	db_board_free(&list);
+	db_close(db);
 	return 0;
 }
@@ -1,7 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <limits.h>
+#include <stdint.h>
 #include <crypt.h>
 #include "utf8.h"
 #include "substr.h"
@@ -13,6 +15,10 @@
  * UTF-8 routines, input sanitation, tripcode routines
  */
 
+/* word at a time byte tests */
+#define BYTES_ONE ((uint64_t) -1 / 0xFF) /* 0x01 in every byte */
+#define BYTES_HIGH (BYTES_ONE * 0x80) /* 0x80 in every byte */
+
 /*
  * UTF-8 encoding
  * Binary    Hex          Comments
@@ -24,19 +30,19 @@
  */
 
 /* lookup tables */
-const unsigned char base16[UCHAR_MAX] = {
+const unsigned char base16[UCHAR_MAX + 1] = {
 	['0'] = 0, ['1'] = 1, ['2'] = 2, ['3'] = 3, ['4'] = 4,
 	['5'] = 5, ['6'] = 6, ['7'] = 7, ['8'] = 8, ['9'] = 9,
 	['A'] = 10, ['B'] = 11, ['C'] = 12, ['D'] = 13, ['E'] = 14, ['F'] = 15,
 	['a'] = 10, ['b'] = 11, ['c'] = 12, ['d'] = 13, ['e'] = 14, ['f'] = 15
 };
 
-const unsigned char wspace[UCHAR_MAX] = {
+const unsigned char wspace[UCHAR_MAX + 1] = {
 	['\a'] = 1, ['\b'] = 1, ['\t'] = 1, ['\n'] = 1,
 	['\v'] = 1, ['\f'] = 1,	['\r'] = 1, [' '] = 1
 };
 
-const char *const escape[UCHAR_MAX] = {
+const char *const escape[UCHAR_MAX + 1] = {
 	['\n'] = "&#013;", /* change '\n' to '\r' */
 	['\"'] = "&quot;",
 	['\''] = "&apos;",
@@ -145,59 +151,140 @@ char *strstr_r(const char *haystack, const char *needle)
 	return NULL;
 }
 
+static size_t utf8_plain_span(const char *str, size_t n)
+{
+	/* length of the leading run of ASCII bytes other than '%'
+	 * within the first n bytes, read a word at a time
+	 */
+	size_t i = 0;
+	uint64_t w;
+	for (; i + sizeof(w) <= n; i += sizeof(w))
+	{
+		memcpy(&w, &str[i], sizeof(w));
+		uint64_t pct = w ^ (BYTES_ONE * '%'); /* zero where '%' was */
+		if ((w | ((pct - BYTES_ONE) & ~pct)) & BYTES_HIGH)
+			break;
+	}
+	while (i < n && !(str[i] & 0x80) && str[i] != '%')
+		i++;
+	return i;
+}
+
 char *utf8_rewrite(char *str)
 {
-	/* converts ASCII escape codes to UTF-8 */
-	/* %E5%88%9D%E9%9F%B3%E3%83%9F%E3%82%AF => 初音ミク */
-	unsigned i, j;
-	for (i = 0; str[i]; i++)
+	/* converts ASCII escape codes to UTF-8 in place, in a single pass
+	 * %E5%88%9D%E9%9F%B3%E3%83%9F%E3%82%AF => 初音ミク
+	 * '%' not followed by two hex digits is kept as is,
+	 * a decoded NUL ends the string
+	 * ill-formed sequences are dropped: stray continuation bytes,
+	 * truncated sequences, overlong forms, surrogates and code points
+	 * past U+10FFFF
+	 */
+	size_t len = strlen(str), r = 0, w = 0, lead = 0; /* read, write, sequence start */
+	unsigned need = 0; /* continuation bytes still expected */
+	unsigned char lo = 0x80, hi = 0xBF; /* range of the next one */
+	while (r < len)
 	{
-		if (str[i] == '%')
+		if (!need) /* plain ASCII runs are moved in bulk */
+		{
+			size_t run = utf8_plain_span(&str[r], len - r);
+			if (w != r)
+				memmove(&str[w], &str[r], run);
+			r += run;
+			w += run;
+			if (r == len)
+				break;
+		}
+		unsigned char c = str[r];
+		if (c == '%' && isxdigit((unsigned char) str[r+1]) && isxdigit((unsigned char) str[r+2]))
 		{
-			for (j = 1; j <= 2; j++)
-				str[i] = (str[i] << 4) | base16(str[i+j]);
-			memmove(&str[i+1], &str[i+3], strlen(&str[i+3]) + 1);
+			c = (base16(str[r+1]) << 4) | base16(str[r+2]);
+			r += 3;
+		}
+		else
+			r++;
+		if (!c)
+			break;
+		if (need)
+		{
+			if (c >= lo && c <= hi)
+			{
+				str[w++] = c;
+				need--;
+				lo = 0x80;
+				hi = 0xBF;
+				continue;
+			}
+			w = lead; /* drop the partial sequence, c may start the next */
+			need = 0;
+		}
+		int seq = utf8_sequence_length(c);
+		if (seq == 1)
+			str[w++] = c;
+		else if (seq > 1)
+		{
+			/* second byte bounds rule out overlong forms,
+			 * surrogates and code points past U+10FFFF
+			 */
+			lead = w;
+			str[w++] = c;
+			need = seq - 1;
+			lo = (c == 0xE0) ? 0xA0 : (c == 0xF0) ? 0x90 : 0x80;
+			hi = (c == 0xED) ? 0x9F : (c == 0xF4) ? 0x8F : 0xBF;
 		}
 	}
+	if (need)
+		w = lead;
+	str[w] = '\0';
 	return str;
 }
 
-
 size_t utf8_charcount(const char *str)
 {
-	/* counts significant character bytes in UTF-8 strings */
-	unsigned count = 0;
-	while (*str++)
-		if ((*str & 0xC0) != 0x80) count++;
-	return count;
+	/* counts characters in UTF-8 strings, every byte that isn't
+	 * a continuation byte, read a word at a time
+	 */
+	size_t len = strlen(str), cont = 0, i = 0;
+	uint64_t w;
+	for (; i + sizeof(w) <= len; i += sizeof(w))
+	{
+		memcpy(&w, &str[i], sizeof(w));
+		w &= ~(w << 1) & BYTES_HIGH; /* high bit of every 10xxxxxx byte */
+		cont += ((w >> 7) * BYTES_ONE) >> 56;
+	}
+	for (; i < len; i++)
+		cont += ((str[i] & 0xC0) == 0x80);
+	return len - cont;
 }
 
 int utf8_sequence_length(const char c)
 {
 	/* returns sequence size of current UTF-8 byte
-	 * if continuation byte, return 0
+	 * if continuation byte or never valid, return 0
 	 */
-	static const unsigned char byte[] = { 0x00, 0x80, 0xC2, 0xE0, 0xF0 };
-	static const int len[] = { 1, 0, 2, 3, 4 };
+	static const unsigned char byte[] = { 0x00, 0x80, 0xC2, 0xE0, 0xF0, 0xF5 };
+	static const int len[] = { 1, 0, 2, 3, 4, 0 };
+	unsigned char b = c;
 	unsigned i;
 	for (i = 1; i < static_size(byte); i++)
-		if (c >= byte[i - 1] && c < byte[i])
+		if (b >= byte[i - 1] && b < byte[i])
 			break;
 	return len[i - 1];
 }
 
 char *utf8_truncate(const char *src, size_t n)
 {
-	/* truncate UTF-8 string up to n - 1 characters
+	/* truncate UTF-8 string up to n characters,
+	 * never splitting a character
 	 * return truncated string
 	 */
-	char *dest = (char *) calloc(strlen(src) + 1, sizeof(char));
-	unsigned i;
-	for (i = 0; src[i] && utf8_charcount(dest) < n; i++)
-		dest[i] = src[i];
-	if (n == utf8_charcount(dest)) /* limit reached */
-		while (i > 0 && utf8_sequence_length(dest[i]) > 1)
-			dest[i--] = '\0';
+	size_t i, count = 0;
+	for (i = 0; src[i]; i++)
+		if ((src[i] & 0xC0) != 0x80 && count++ == n)
+			break;
+	char *dest = (char *) malloc(i + 1);
+	memcpy(dest, src, i);
+	dest[i] = '\0';
 	return dest;
 }
 
@@ -267,35 +354,93 @@ char *strip_whitespace(char *str)
 			count = 0;
 		}
 	}
-	unsigned len = strlen(str) - 1;
-	while (wspace(str[len])) /* <-- */
-		str[len--] = '\0';
+	size_t len = strlen(str);
+	while (len && wspace(str[len - 1])) /* <-- */
+		str[--len] = '\0';
 	substr_restore(extract, str);
 	return str;
 }
 
+static const char *escape_set(void)
+{
+	/* bytes with an escape code, as a strcspn() set
+	 * built from escape[] on first use
+	 */
+	static char set[UCHAR_MAX + 1];
+	if (!*set)
+	{
+		unsigned c, n = 0;
+		for (c = 1; c <= UCHAR_MAX; c++)
+			if (escape(c))
+				set[n++] = c;
+	}
+	return set;
+}
+
 char *xss_sanitize(char **loc)
 {
-	/* replaces html syntax with escape codes in place
+	/* replaces html syntax with escape codes
 	 * char ** pointer required to update stack pointer
-	 * with new string location because realloc loses the original
+	 * with the new string location
+	 * escaped length is counted first so the result is allocated once,
+	 * runs of clean bytes in between are found with strcspn() and
+	 * copied in bulk
 	 */
-	char *str = *loc;
-	unsigned i;
-	for (i = 0; str[i]; i++)
+	const char *set = escape_set(), *src = *loc;
+	size_t len, extra = 0, i, j;
+	for (i = 0; src[i]; ) /* count */
 	{
-		if (escape(str[i]))
-		{
-			unsigned offset = strlen(escape(str[i]));
-			str = (char *) realloc(str, strlen(str) + offset + 1);
-			memmove(&str[i+offset], &str[i+1], strlen(&str[i+1]) + 1);
-			memcpy(&str[i], escape(str[i]), offset);
-		}
+		if (escape(src[i]))
+			extra += strlen(escape(src[i++])) - 1;
+		else
+			i += strcspn(&src[i], set);
+	}
+	if (!extra) /* nothing to escape */
+		return *loc;
+	len = i;
+	char *str = (char *) malloc(len + extra + 1);
+	for (i = j = 0; i < len; )
+	{
+		const char *code = escape(src[i]);
+		size_t n = (code) ? strlen(code) : strcspn(&src[i], set);
+		memcpy(&str[j], (code) ? code : &src[i], n);
+		j += n;
+		i += (code) ? 1 : n;
 	}
+	str[j] = '\0';
+	free(*loc);
 	*loc = str;
 	return str;
 }
 
+char *xss_truncate(const char *src, size_t n)
+{
+	/* truncate sanitized string up to n characters,
+	 * an escape code counts as one and is never split,
+	 * one already cut short at the end of src is dropped
+	 * return truncated string
+	 */
+	size_t i = 0, count = 0;
+	while (src[i] && count++ < n)
+	{
+		if (src[i] == '&')
+		{
+			size_t len = 1;
+			while (len < ESCAPE_MAX && (isalnum((unsigned char) src[i + len]) || src[i + len] == '#'))
+				len++;
+			if (!src[i + len]) /* cut short */
+				break;
+			i += (src[i + len] == ';') ? len + 1 : 1;
+		}
+		else
+			do i++; while ((src[i] & 0xC0) == 0x80); /* whole UTF-8 character */
+	}
+	char *dest = (char *) malloc(i + 1);
+	memcpy(dest, src, i);
+	dest[i] = '\0';
+	return dest;
+}
+
 int spam_filter(const char *str)
 {
 	/* rudimentary spam filter
@@ -325,6 +470,37 @@ int spam_filter(const char *str)
 	return (count >= SPAM_LIMIT);
 }
 
+long text_fingerprint(const char *str)
+{
+	/* 64-bit FNV-1a hash of sanitized text for duplicate detection
+	 * ASCII case is ignored and runs of whitespace, including escaped
+	 * newlines, count as a single space
+	 */
+	const char *nl = escape('\n');
+	const size_t nl_len = strlen(nl);
+	uint64_t h = 14695981039346656037ULL;
+	unsigned space = 0, text = 0, i = 0;
+	while (str[i])
+	{
+		if (wspace(str[i]) || (str[i] == *nl && !strncmp(&str[i], nl, nl_len)))
+		{
+			i += (wspace(str[i])) ? 1 : nl_len;
+			space = 1;
+			continue;
+		}
+		unsigned char c = str[i++];
+		if (space && text) /* not leading */
+		{
+			h ^= ' ';
+			h *= 1099511628211ULL;
+		}
+		space = 0, text = 1;
+		h ^= (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+		h *= 1099511628211ULL;
+	}
+	return (long) h;
+}
+
 char *tripcode_pass(char **nameptr)
 {
 	/* splits 'name#pass' string with '\0'
@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+#include "global.h"
+#include "database.h"
+#include "markup.h"
+#include "utf8.h"
+#include "dump.h"
+#include "macros.h"
+
+/*
+ * [build check]
+ * markup_diff.c
+ * renders every comment of a corpus, of board dumps, and comments
+ * generated from fragments of markup, with both the current and the
+ * reference enquote_comment() and format_comment(), fails on any difference
+ */
+
+/* USAGE:
+ * make markup-diff
+ * markup_diff <schema.sql> <corpus.txt> [board.dump ...]
+ * corpus comments are separated by lines holding a single '%'
+ * dumps are akari-dump output, their posts are loaded so that
+ * linkquotes between them resolve
+ */
+
+char *reference_enquote_comment(char **loc, const char *board_id, const long parent_id, const struct quotelist *ql);
+char *reference_format_comment(char **loc);
+
+#define GENERATED 20000 /* comments built from fragments */
+
+/* posts the linkquotes resolve against, comments are posted to /a/
+ * >>2 >>3 same thread, >>4 >>5 another thread, >>>/b/2 another board
+ */
+static const char *const fixture =
+	"INSERT INTO posts(board_id, parent_id, id, time, options, user_priv, del_pass, ip, comment) "
+	"VALUES('a', 1, 1, 0, 0, 0, '', '', ''), ('a', 1, 2, 0, 0, 0, '', '', ''), "
+	"('a', 1, 3, 0, 0, 0, '', '', ''), ('a', 4, 4, 0, 0, 0, '', '', ''), "
+	"('a', 4, 5, 0, 0, 0, '', '', ''), ('b', 1, 1, 0, 0, 0, '', '', ''), "
+	"('b', 1, 2, 0, 0, 0, '', '', '');";
+
+static const char *const fragment[] = {
+	">", ">>", ">>1", ">>2", ">>3", ">>5", ">>9", ">>0", ">>12", ">>>/b/2", ">>>/b/1",
+	">>>/c/3", ">>>/b/", ">>>/", ">>>//3", ">>999999999999999999999",
+	"\r\n", "\r\n>", "\r\n\r\n", "a", "b c", " ", "&", "<", "\"",
+	"[spoiler]", "[/spoiler]", "[code]", "[/code]", "[spoiler", "code]"
+};
+
+static long compared, mismatched;
+
+static char *read_file(const char *path)
+{
+	/* returns the whole file, or NULL */
+	FILE *fp = fopen(path, "r");
+	if (!fp)
+		return NULL;
+	size_t len = 0, size = BUFSIZ;
+	char *buf = malloc(size);
+	while ((len += fread(buf + len, 1, size - len - 1, fp)) == size - 1)
+		buf = realloc(buf, size *= 2);
+	buf[len] = '\0';
+	fclose(fp);
+	return buf;
+}
+
+static void report(const char *stage, const char *input, const char *expected, const char *actual)
+{
+	/* the first few differences are printed in full */
+	if (mismatched++ < 10)
+		fprintf(stderr, "%s mismatch\ninput:    %s\nexpected: %s\nactual:   %s\n\n",
+		        stage, input, expected, actual);
+}
+
+static int check(sqlite3 *db, const char *comment, const char *board_id, const long parent_id)
+{
+	/* render a sanitized comment both ways
+	 * returns error code
+	 */
+	struct quotelist ql = { 0 };
+	int err = 0;
+	markup_quotes(&ql, comment, board_id);
+	if (*comment && !(err = markup_resolve(db, &ql)))
+	{
+		char *expected = strdup(comment), *actual = strdup(comment);
+		reference_enquote_comment(&expected, board_id, parent_id, &ql);
+		enquote_comment(&actual, board_id, parent_id, &ql);
+		compared++;
+		if (strcmp(expected, actual))
+			report("enquote_comment()", comment, expected, actual);
+		else
+		{
+			reference_format_comment(&expected);
+			format_comment(&actual);
+			if (strcmp(expected, actual))
+				report("format_comment()", comment, expected, actual);
+		}
+		free(expected);
+		free(actual);
+	}
+	markup_quotes_free(&ql);
+	return err;
+}
+
+static int check_raw(sqlite3 *db, const char *raw)
+{
+	/* sanitize a comment the way submit.c does, then check it
+	 * as a reply in thread 1 of /a/ and as a new thread
+	 */
+	char *comment = strdup(raw);
+	if (!comment)
+		return 0;
+	strip_whitespace(utf8_rewrite(comment));
+	xss_sanitize(&comment);
+	int err = check(db, comment, "a", 1);
+	if (!err)
+		err = check(db, comment, "a", 0);
+	free(comment);
+	return err;
+}
+
+static int check_dump(sqlite3 *db, const char *path, int load)
+{
+	/* load the posts of a dump, or check their stored comments
+	 * the way akari-render renders them
+	 * returns error code
+	 */
+	static const char *const insert =
+		"INSERT OR IGNORE INTO posts(board_id, parent_id, id, time, options, user_priv, del_pass, ip, comment) "
+		"VALUES(?1, ?2, ?3, 0, 0, 0, '', '', ?4);";
+	char *dump = read_file(path), *line, *next, *f[DUMP_MAX_FIELDS];
+	char board_id[64] = "";
+	sqlite3_stmt *stmt = NULL;
+	int err = (!dump) ? SQLITE_CANTOPEN : (load) ? sqlite3_prepare_v2(db, insert, -1, &stmt, NULL) : 0;
+	for (line = dump; !err && line && *line; line = next)
+	{
+		next = line + strcspn(line, "\n");
+		next += (*next == '\n');
+		unsigned n = dump_split(line, f, DUMP_MAX_FIELDS);
+		if (n == 6 && !strcmp(f[0], "B") && strlen(f[1]) < sizeof(board_id))
+			strcpy(board_id, f[1]);
+		if (n != DUMP_MAX_FIELDS || strcmp(f[0], "P") || !*board_id || !f[11])
+			continue;
+		if (!load)
+			err = check(db, f[11], board_id, atol(f[1]));
+		else
+		{
+			sqlite3_bind_text(stmt, 1, board_id, -1, SQLITE_STATIC);
+			sqlite3_bind_int64(stmt, 2, atol(f[1]));
+			sqlite3_bind_int64(stmt, 3, atol(f[2]));
+			sqlite3_bind_text(stmt, 4, f[11], -1, SQLITE_STATIC);
+			err = (sqlite3_step(stmt) == SQLITE_DONE) ? 0 : sqlite3_errcode(db);
+			sqlite3_reset(stmt);
+		}
+	}
+	sqlite3_finalize(stmt);
+	free(dump);
+	return err;
+}
+
+int main(int argc, char **argv)
+{
+	sqlite3 *db;
+	char *schema, *corpus, *err = NULL;
+	if (argc < 3 || !(schema = read_file(argv[1])) || !(corpus = read_file(argv[2])))
+	{
+		fprintf(stderr, "usage: %s <schema.sql> <corpus.txt> [board.dump ...]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (sqlite3_open(":memory:", &db) ||
+	    sqlite3_exec(db, schema, NULL, NULL, &err) ||
+	    sqlite3_exec(db, fixture, NULL, NULL, &err))
+	{
+		fprintf(stderr, "%s: %s\n", argv[1], err ? err : sqlite3_errmsg(db));
+		return EXIT_FAILURE;
+	}
+	free(schema);
+
+	/* corpus, with line breaks as a browser submits them */
+	size_t size = max(strlen(corpus) * 2, 4096) + 1, len = 0;
+	char *raw = malloc(size), *line, *next;
+	int failed = 0;
+	for (line = corpus; !failed && *line; line = next)
+	{
+		next = line + strcspn(line, "\n");
+		next += (*next == '\n');
+		if (strncmp(line, "%\n", next - line))
+		{
+			memcpy(&raw[len], line, next - line);
+			len += next - line;
+			if (raw[len - 1] == '\n')
+				strcpy(&raw[len - 1], "\r\n"), len++;
+			if (*next)
+				continue;
+		}
+		while (len && (raw[len - 1] == '\n' || raw[len - 1] == '\r'))
+			len--; /* line break before the separator */
+		raw[len] = '\0';
+		failed = check_raw(db, raw);
+		len = 0;
+	}
+	printf("%s: %ld comments compared\n", argv[2], compared);
+
+	/* dumps, every post loaded before any is checked */
+	long counted = compared;
+	int i;
+	for (i = 3; !failed && i < argc; i++)
+		failed = check_dump(db, argv[i], 1);
+	for (i = 3; !failed && i < argc; i++, counted = compared)
+	{
+		failed = check_dump(db, argv[i], 0);
+		printf("%s: %ld comments compared\n", argv[i], compared - counted);
+	}
+
+	/* generated, the same sequence every run */
+	long k;
+	srand(1);
+	for (k = 0, counted = compared; !failed && k < GENERATED; k++)
+	{
+		int n = 1 + rand() % 40;
+		for (*raw = '\0'; n--; )
+			strcat(raw, fragment[rand() % static_size(fragment)]);
+		failed = check_raw(db, raw);
+	}
+	printf("generated: %ld comments compared\n", compared - counted);
+	free(raw);
+	free(corpus);
+	db_close(db);
+	if (failed)
+		fprintf(stderr, "%s\n", sqlite3_errstr(failed));
+	if (mismatched)
+		fprintf(stderr, "%ld of %ld comments render differently\n", mismatched, compared);
+	return (failed || mismatched) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
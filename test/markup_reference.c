@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+#include "global.h"
+#include "database.h"
+#include "markup.h"
+#include "utf8.h"
+#include "substr.h"
+#include "macros.h"
+
+/*
+ * [build check]
+ * markup_reference.c
+ * enquote_comment() and format_comment() as they were before being
+ * rewritten to a single pass, kept as the reference for markup_diff.c
+ * do not fix, any change in output here is a change in rendered posts
+ */
+
+#define BOARD_ID_MAX 32 /* longest board id in a cross-board linkquote */
+
+static unsigned linkquote_parse(const char *str, char *board, long *id)
+{
+	/* match an escaped linkquote at the start of str
+	 * '>>N' quotes a post on the same board, board is set empty
+	 * '>>>/board/N' quotes a post on any board
+	 * post number cannot begin with a leading zero
+	 * returns length of the match, 0 if none
+	 */
+	const char *gt = escape('>');
+	unsigned len = strlen(gt), i = len * 2, n = 0;
+	*board = '\0';
+	if (strncmp(str, gt, len) || strncmp(&str[len], gt, len))
+		return 0;
+	if (!strncmp(&str[i], gt, len) && str[i + len] == '/')
+	{
+		for (i += len + 1; n < BOARD_ID_MAX - 1; n++, i++)
+		{
+			char c = str[i];
+			if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')))
+				break;
+			board[n] = c;
+		}
+		board[n] = '\0';
+		if (!n || str[i++] != '/')
+			return 0;
+	}
+	if (str[i] < '1' || str[i] > '9')
+		return 0;
+	for (*id = 0, n = 0; str[i] >= '0' && str[i] <= '9' && n < 18; n++) /* fits in 64 bits */
+		*id = (*id * 10) + (str[i++] - '0');
+	return i;
+}
+
+static int linkquote_cmp(const void *a, const void *b)
+{
+	/* order by board, then post number */
+	const struct linkquote *x = (const struct linkquote *) a;
+	const struct linkquote *y = (const struct linkquote *) b;
+	int cmp = strcmp(x->board_id, y->board_id);
+	return (cmp) ? cmp : (x->id > y->id) - (x->id < y->id);
+}
+
+static const struct linkquote *linkquote_find(const struct quotelist *ql, const char *board_id, long id)
+{
+	/* returns resolved linkquote, NULL if not collected */
+	struct linkquote key;
+	key.board_id = (char *) board_id;
+	key.id = id;
+	if (!ql || !ql->count)
+		return NULL;
+	return (const struct linkquote *) bsearch(&key, ql->arr, ql->count, sizeof(*ql->arr), linkquote_cmp);
+}
+
+char *reference_enquote_comment(char **loc, const char *board_id, const long parent_id, const struct quotelist *ql)
+{
+	/* rewrite string with quote markup
+	 * linkquotes are looked up in ql, see markup_resolve()
+	 * - quotes within the thread are previewed by 'popup(self, request, hover)'
+	 * - quotes of other threads link to the thread
+	 * - quotes of posts that don't exist are struck out
+	 */
+	const char *gt = escape('>'), *nl = escape('\n'); /* escape codes */
+	static const char *const quote[] = {
+		"<span class=\"quote\">", "</span>"
+	};
+	static const char *const linkquote[] = {
+		/* same thread */
+		"<a class=\"linkquote\" href=\"#p%ld\" "
+		"onMouseOver=\"popup(this,'p%ld',1)\" "
+		"onMouseOut=\"popup(this,'p%ld',0)\" "
+		"onClick=\"popup(this,'p%ld',0)\">",
+		/* another thread, previewed if it's on the same page */
+		"<a class=\"linkquote\" href=\"%s?board=%s&thread=%ld#p%ld\" "
+		"onMouseOver=\"popup(this,'p%ld',1)\" "
+		"onMouseOut=\"popup(this,'p%ld',0)\">",
+		/* another board */
+		"<a class=\"linkquote\" href=\"%s?board=%s&thread=%ld#p%ld\">",
+		"</a>",
+		/* dead link */
+		"<span class=\"linkquote invalid\">", "</span>"
+	};
+	char *str = *loc;
+	if (!strstr(str, gt)) /* no '>' found */
+		return str;
+	unsigned i;
+	for (i = 0; str[i]; i++)
+	{
+		unsigned length = strlen(str);
+		char *seek = strstr(&str[i], gt); /* seek to next '>' or to end */
+		i = (!seek) ? length : (unsigned) (seek - str);
+		if (length < i + max(strlen(gt), strlen(nl))) /* bounds check */
+			break;
+		/* '>>' linkquote */
+		else if (!memcmp(&str[i + strlen(gt)], gt, strlen(gt)))
+		{
+			char board[BOARD_ID_MAX];
+			long id;
+			unsigned n = linkquote_parse(&str[i], board, &id);
+			if (n)
+			{
+				const struct linkquote *lq = linkquote_find(ql, (*board) ? board : board_id, id);
+				const char *close = linkquote[3];
+				char tag[BOARD_ID_MAX + 400]; /* tag buffer */
+				if (!lq || !lq->parent_id) /* dead */
+				{
+					sprintf(tag, "%s", linkquote[4]);
+					close = linkquote[5];
+				}
+				else if (strcmp(lq->board_id, board_id))
+					sprintf(tag, linkquote[2], BOARD_SCRIPT, lq->board_id, lq->parent_id, id);
+				else if (lq->parent_id != parent_id)
+					sprintf(tag, linkquote[1], BOARD_SCRIPT, lq->board_id, lq->parent_id, id, id, id);
+				else
+					sprintf(tag, linkquote[0], id, id, id, id);
+				unsigned offset_a = strlen(tag); /* part 1 */
+				str = (char *) realloc(str, strlen(str) + offset_a + 1);
+				memmove(&str[i+offset_a], &str[i], strlen(&str[i]) + 1);
+				memcpy(&str[i], tag, offset_a);
+				unsigned j = i + offset_a + n; /* right of the post number */
+
+				unsigned offset_b = strlen(close); /* part 2 */
+				str = (char *) realloc(str, strlen(str) + offset_b + 1);
+				memmove(&str[j+offset_b], &str[j], strlen(&str[j]) + 1);
+				memcpy(&str[j], close, offset_b);
+				i = j + offset_b - 1; /* resume after the link */
+			}
+			else
+				i += (strlen(gt) * 2) - 1;
+		}
+		/* '>' quote */
+		else if (&str[0] == &str[i] || /* conditional bounds checking */
+		!memcmp(&str[i - ((i < strlen(nl)) ? 0 : strlen(nl))], nl, strlen(nl)))
+		{
+			/* don't seek backwards if too close to the start of the array
+			 * '>' quotes are only valid at the start of a new line
+			 */
+			unsigned offset_a = strlen(quote[0]); /* part 1 */
+			str = (char *) realloc(str, strlen(str) + offset_a + 1);
+			memmove(&str[i+offset_a], &str[i], strlen(&str[i]) + 1);
+			memcpy(&str[i], quote[0], offset_a);
+
+			/* seek to the next newline or to end */
+			char *pos = strstr(&str[i], nl); /* part 2 */
+			unsigned j = (!pos) ? strlen(str) : (unsigned) (pos - str);
+			unsigned offset_b = strlen(quote[1]);
+			str = (char *) realloc(str, strlen(str) + offset_b + 1);
+			memmove(&str[j+offset_b], &str[j], strlen(&str[j]) + 1);
+			memcpy(&str[j], quote[1], offset_b);
+			i += offset_a + strlen(gt) - 1; /* linkquotes may follow */
+		}
+	}
+	*loc = str;
+	return str;
+}
+
+char *reference_format_comment(char **loc)
+{
+	/* replace matching [tags] with corresponding markup with exceptions:
+	 * 1. nesting:
+	 *     - nesting of [tags] is fine
+	 * 2. auto-complete:
+	 *     - implicit [/tag] added to end of string if none found
+	 * 3. [code] blocks:
+	 *     - nesting of other tags within code blocks is not allowed
+	 *     - must be processed last for this reason
+	 */
+	static const char *const markup[] = {
+		[SPOILER_L] = "<span class=\"spoiler\">", [SPOILER_R] = "</span>",
+		[CODE_L] = "<div class=\"codeblock\">", [CODE_R] = "</div>"
+	};
+	/* some assumptions about the format tag system */
+	static_assert(static_size(markup) == SUPPORTED_TAGS); /* size check */
+	static_assert((SUPPORTED_TAGS % 2) == 0); /* tag count must be even */
+	static_assert((SUPPORTED_TAGS - 2) == CODE_L); /* [code] must come last */
+
+	char *str = *loc;
+	struct substr *extract = substr_extract(str, fmt[CODE_L], fmt[CODE_R]);
+	unsigned i, j, k, l;
+	for (i = 0; i < SUPPORTED_TAGS; i += 2)
+	{
+		if (i == CODE_L) /* restore [code] tag regions */
+			substr_restore(extract, str);
+		for (j = 0; str[j]; j++)
+		{
+			char *from = strstr(&str[j], fmt[i]); /* left tag */
+			j = (!from) ? strlen(str) : (unsigned) (from - str);
+			if (!str[j])
+				break;
+			k = strstr(str, fmt[i+1]) - str;
+			if (j >= k) /* malformed tag order */
+				break;
+			l = strlen(fmt[i]); /* overlap */
+			memmove(&str[j], &str[j+l], strlen(&str[j+l]) + 1);
+			unsigned offset_a = strlen(markup[i]);
+			str = (char *) realloc(str, strlen(str) + offset_a + 1);
+			memmove(&str[j+offset_a], &str[j], strlen(&str[j]) + 1);
+			memcpy(&str[j], markup[i], offset_a);
+
+			char *to = strstr(&str[j], fmt[i+1]); /* right tag */
+			k = (!to) ? strlen(str) : (unsigned) (to - str);
+			l = strlen(fmt[i+1]); /* overlap */
+			if (to) /* overlap only if tag found */
+				memmove(&str[k], &str[k+l], strlen(&str[k+l]) + 1);
+			unsigned offset_b = strlen(markup[i+1]);
+			str = (char *) realloc(str, strlen(str) + offset_b + 1);
+			memmove(&str[k+offset_b], &str[k], strlen(&str[k]) + 1);
+			memcpy(&str[k], markup[i+1], offset_b);
+		}
+	}
+	*loc = str;
+	return str;
+}
@@ -0,0 +1,131 @@
+#include "database.c" /* registry[] is private to it */
+
+/*
+ * [build check]
+ * plan_check.c
+ * loads the schema into memory and fails if the query plan of any
+ * registered statement scans a table instead of searching an index
+ */
+
+/* USAGE:
+ * make plan-check
+ * plan_check <schema.sql>
+ */
+
+/* tables these statements are expected to read whole */
+static const struct {
+	enum statement id;
+	const char *table;
+} allowed[] = {
+	{ SQL_BOARD_LIST, "boards" }, /* a handful of rows */
+	{ SQL_RESTORE_STAGE, "main.posts" }, /* LIMIT 0, copies the columns */
+	{ SQL_RESTORE_POSTS, "restore_posts" } /* the staged batch */
+};
+
+static char *read_file(const char *path)
+{
+	/* returns the whole file, or NULL */
+	FILE *fp = fopen(path, "r");
+	if (!fp)
+		return NULL;
+	size_t len = 0, size = BUFSIZ;
+	char *buf = malloc(size);
+	while ((len += fread(buf + len, 1, size - len - 1, fp)) == size - 1)
+		buf = realloc(buf, size *= 2);
+	buf[len] = '\0';
+	fclose(fp);
+	return buf;
+}
+
+static int scan_allowed(enum statement id, const char *detail, const char *subqueries)
+{
+	/* detail is a scan row, subqueries holds the names of the
+	 * CTEs and subqueries materialized earlier in the same plan
+	 */
+	char name[128];
+	const char *table = strchr(detail, ' ') + 1;
+	size_t i, n = strcspn(table, " ");
+	if (n >= sizeof(name))
+		return 0;
+	memcpy(name, table, n);
+	name[n] = '\0';
+	/* virtual tables report every access as a scan, an unconstrained
+	 * one has neither an index number nor an index string
+	 */
+	const char *vtab = strstr(detail, " VIRTUAL TABLE INDEX ");
+	if (vtab)
+		return strcmp(vtab + 21, "0:") != 0;
+	for (i = 0; i < sizeof(allowed) / sizeof(*allowed); i++)
+		if (allowed[i].id == id && !strcmp(allowed[i].table, name))
+			return 1;
+	const char *s = subqueries;
+	while ((s = strstr(s, name)))
+	{
+		if ((s == subqueries || s[-1] == ' ') && s[n] == ' ')
+			return 1;
+		s += n;
+	}
+	return 0;
+}
+
+static int plan_check(sqlite3 *db, enum statement id)
+{
+	/* prints the plan of a statement that scans a table, returns 0 if it does */
+	sqlite3_stmt *stmt;
+	char *sql = sql_generate("EXPLAIN QUERY PLAN %s", registry[id].sql);
+	if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL))
+	{
+		fprintf(stderr, "statement %d: %s\n\t%s\n", id, registry[id].sql, sqlite3_errmsg(db));
+		free(sql);
+		return 0;
+	}
+	free(sql);
+	char subqueries[1024] = "", report[4096] = "";
+	int ok = 1;
+	while (sqlite3_step(stmt) == SQLITE_ROW)
+	{
+		const char *detail = (const char *) sqlite3_column_text(stmt, 3);
+		const char *sub = !strncmp(detail, "MATERIALIZE ", 12) ? detail + 12 :
+		                  !strncmp(detail, "CO-ROUTINE ", 11) ? detail + 11 : NULL;
+		if (sub && strlen(subqueries) + strlen(sub) + 2 < sizeof(subqueries))
+			strcat(strcat(subqueries, sub), " ");
+		/* MIN() and MAX() over a full scan are reported as a SEARCH without an index */
+		int scan = !strncmp(detail, "SCAN ", 5) ||
+		           (!strncmp(detail, "SEARCH ", 7) && !strstr(detail, " USING "));
+		if (scan && !scan_allowed(id, detail, subqueries))
+			ok = 0;
+		if (strlen(report) + strlen(detail) + 3 < sizeof(report))
+			strcat(strcat(strcat(report, "\t"), detail), "\n");
+	}
+	sqlite3_finalize(stmt);
+	if (!ok)
+		fprintf(stderr, "statement %d: %s\n%s", id, registry[id].sql, report);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	sqlite3 *db;
+	char *schema, *err = NULL;
+	int id, failed = 0;
+	if (argc != 2 || !(schema = read_file(argv[1])))
+	{
+		fprintf(stderr, "usage: %s <schema.sql>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	/* the restore staging table only exists once a restore begins */
+	if (sqlite3_open(":memory:", &db) ||
+	    sqlite3_exec(db, schema, NULL, NULL, &err) ||
+	    sqlite3_exec(db, registry[SQL_RESTORE_STAGE].sql, NULL, NULL, &err))
+	{
+		fprintf(stderr, "%s: %s\n", argv[1], err ? err : sqlite3_errmsg(db));
+		return EXIT_FAILURE;
+	}
+	free(schema);
+	for (id = 0; id < SQL_STATEMENTS; id++)
+		failed += !plan_check(db, id);
+	sqlite3_close(db);
+	if (failed)
+		fprintf(stderr, "%d of %d statements scan a table\n", failed, SQL_STATEMENTS);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,93 @@
+#define main board_main /* render_stale() is private to board.c */
+#include "board.c"
+#undef main
+
+/*
+ * [build check]
+ * render_check.c
+ * renders stale posts the way board.c displays them, fails if any
+ * comment isn't rendered or a fresh one is rendered again
+ */
+
+/* USAGE:
+ * make render-check
+ */
+
+/* the posts linkquotes resolve against */
+static const char *const fixture =
+	"CREATE TABLE posts (board_id TEXT NOT NULL, parent_id INTEGER NOT NULL, "
+		"id INTEGER NOT NULL, PRIMARY KEY (board_id, id));"
+	"INSERT INTO posts VALUES ('test', 1, 1), ('test', 1, 2);";
+
+static int failed;
+
+static void expect(const char *name, const struct post *p, const char *markup)
+{
+	/* markup must appear in the rendered comment, NULL if it mustn't be rendered */
+	int ok = (!markup) ? !p->rendered : p->rendered && strstr(p->rendered, markup);
+	if (!ok)
+	{
+		fprintf(stderr, "%s: expected %s, rendered %s\n", name,
+		        (!markup) ? "(null)" : markup, (!p->rendered) ? "(null)" : p->rendered);
+		failed++;
+	}
+}
+
+static void stale(struct post *p, long id, const char *comment, const char *rendered)
+{
+	/* a post of thread 1 on /test/, rendered is NULL for a stale post */
+	memset(p, 0, sizeof(*p));
+	p->board_id = "test";
+	p->parent_id = 1;
+	p->id = id;
+	p->comment = (char *) comment;
+	p->rendered = (!rendered) ? NULL : strdup(rendered);
+}
+
+static void reset(struct resource *res)
+{
+	/* free markup rendered by render_stale() */
+	unsigned i;
+	for (i = 0; i < res->count; i++)
+		free(res->arr[i].rendered);
+}
+
+int main(void)
+{
+	sqlite3 *db;
+	struct post arr[4];
+	struct resource res = { 0, arr };
+	if (sqlite3_open(":memory:", &db) || sqlite3_exec(db, fixture, NULL, NULL, NULL))
+	{
+		fprintf(stderr, "fixture: %s\n", sqlite3_errmsg(db));
+		return EXIT_FAILURE;
+	}
+
+	/* stale posts without linkquotes, as every post is after migrate_v14.sql */
+	stale(&arr[0], 1, "This is a sample comment!", NULL);
+	stale(&arr[1], 2, "This is comment #2", NULL);
+	res.count = 2;
+	render_stale(db, &res, 0);
+	expect("no linkquotes, OP", &arr[0], "This is a sample comment!");
+	expect("no linkquotes, reply", &arr[1], "This is comment #2");
+	reset(&res);
+
+	/* linkquotes and quotes among stale, fresh and skipped posts */
+	stale(&arr[0], 1, "skipped by offset", NULL);
+	stale(&arr[1], 2, "&gt;&gt;1 and &gt;&gt;9", NULL);
+	stale(&arr[2], 3, "&gt;green text", NULL);
+	stale(&arr[3], 4, "&gt;&gt;2", "already rendered");
+	res.count = 4;
+	render_stale(db, &res, 1);
+	expect("offset", &arr[0], NULL);
+	expect("linkquote", &arr[1], "href=\"#p1\"");
+	expect("dead linkquote", &arr[1], "<span class=\"linkquote invalid\">&gt;&gt;9</span>");
+	expect("quote", &arr[2], "<span class=\"quote\">&gt;green text</span>");
+	expect("fresh", &arr[3], "already rendered");
+	reset(&res);
+
+	db_close(db);
+	if (failed)
+		fprintf(stderr, "%d stale post checks failed\n", failed);
+	return (failed) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
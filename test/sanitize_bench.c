@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "utf8.h"
+
+/*
+ * [build check]
+ * sanitize_bench.c
+ * xss_sanitize() throughput on typical and adversarial posts, against
+ * the byte at a time version it replaced, fails if their output differs
+ * or if escaping stops being linear in the length of the post
+ */
+
+/* USAGE:
+ * make sanitize-bench
+ */
+
+#define RANDOM_STRINGS 200000 /* compared with the reference */
+#define MIN_SECONDS 0.2 /* per measurement */
+
+static char *reference_xss_sanitize(char **loc)
+{
+	/* xss_sanitize() before it allocated once, quadratic in escapes */
+	char *str = *loc;
+	unsigned i;
+	for (i = 0; str[i]; i++)
+	{
+		if (escape(str[i]))
+		{
+			unsigned offset = strlen(escape(str[i]));
+			str = (char *) realloc(str, strlen(str) + offset + 1);
+			memmove(&str[i+offset], &str[i+1], strlen(&str[i+1]) + 1);
+			memcpy(&str[i], escape(str[i]), offset);
+		}
+	}
+	*loc = str;
+	return str;
+}
+
+static double throughput(char *(*sanitize)(char **), const char *in)
+{
+	/* returns MB of input sanitized per second of CPU time */
+	size_t len = strlen(in);
+	long runs = 0;
+	clock_t start = clock(), elapsed;
+	do
+	{
+		char *s = malloc(len + 1);
+		memcpy(s, in, len + 1);
+		sanitize(&s);
+		free(s);
+		runs++;
+	} while ((elapsed = clock() - start) < MIN_SECONDS * CLOCKS_PER_SEC);
+	return len * (double) runs / ((double) elapsed / CLOCKS_PER_SEC) / 1e6;
+}
+
+static char *repeat(const char *pattern, size_t len)
+{
+	/* pattern repeated up to len bytes */
+	char *s = malloc(len + 1);
+	size_t i, n = strlen(pattern);
+	for (i = 0; i < len; i++)
+		s[i] = pattern[i % n];
+	s[len] = '\0';
+	return s;
+}
+
+int main(void)
+{
+	static const struct {
+		const char *name;
+		const char *pattern;
+		size_t len;
+	} input[] = {
+		{ "plain text", "abcdefgh ij", 2000 },
+		{ "typical post", "The quick brown fox jumps over the lazy dog and \"quotes\" it's fine.\n", 2000 },
+		{ "mixed escapes", "a<b>&'\"\n", 2000 },
+		{ "'<' only", "<", 2000 },
+		{ "'<' only", "<", 65536 }
+	};
+	const unsigned count = sizeof(input) / sizeof(*input);
+	double mbps[sizeof(input) / sizeof(*input)];
+	unsigned i;
+	long k, mismatched = 0;
+
+	/* same output as the reference on random bytes */
+	srand(3);
+	for (k = 0; k < RANDOM_STRINGS; k++)
+	{
+		char raw[300];
+		int n = 1 + rand() % 299, j;
+		for (j = 0; j < n; j++)
+			raw[j] = 1 + rand() % 255;
+		raw[n] = '\0';
+		char *expected = strdup(raw), *actual = strdup(raw);
+		reference_xss_sanitize(&expected);
+		xss_sanitize(&actual);
+		mismatched += (strcmp(expected, actual) != 0);
+		free(expected);
+		free(actual);
+	}
+	printf("random: %d strings compared, %ld mismatched\n\n", RANDOM_STRINGS, mismatched);
+
+	printf("%-14s %6s %12s %12s\n", "input", "bytes", "before MB/s", "after MB/s");
+	for (i = 0; i < count; i++)
+	{
+		char *in = repeat(input[i].pattern, input[i].len);
+		mbps[i] = throughput(xss_sanitize, in);
+		printf("%-14s %6lu %12.1f %12.1f\n", input[i].name, (unsigned long) input[i].len,
+		       throughput(reference_xss_sanitize, in), mbps[i]);
+		free(in);
+	}
+
+	/* linear escaping keeps its throughput as a post grows 32 times,
+	 * quadratic escaping loses nearly all of it
+	 */
+	int quadratic = mbps[count - 1] < mbps[count - 2] / 4;
+	if (mismatched)
+		fprintf(stderr, "xss_sanitize() differs from the reference\n");
+	if (quadratic)
+		fprintf(stderr, "xss_sanitize() slows down with the length of the post\n");
+	return (mismatched || quadratic) ? EXIT_FAILURE : EXIT_SUCCESS;
+}